@@ -0,0 +1,81 @@
+#include "gameboy.hpp"
+
+#include <print>
+#include <chrono>
+#include <cstdlib>
+#include <string_view>
+
+// headless benchmark, runs a ROM for a number of frames without the boot ROM and reports the emulation speed
+// usage: dmg_bench <rom> [frames] [--fifo]
+
+#if defined(PEDALS_AOT)
+static const char* interpreter_name = "aot";
+#elif defined(PEDALS_JIT)
+static const char* interpreter_name = "jit";
+#elif defined(PEDALS_THREADED_INTERPRETER)
+static const char* interpreter_name = "threaded";
+#else
+static const char* interpreter_name = "switch";
+#endif
+
+int main(int argc, char** argv) {
+	// --fifo can go anywhere, the rest are the rom and the frame count in that order
+	const char* rom = nullptr;
+	int frames = 3600;
+	pedals::ppu::Renderer ppu_renderer = pedals::ppu::Renderer::Scanline;
+
+	for (int i = 1, position = 0; i < argc; i++) {
+		if (std::string_view(argv[i]) == "--fifo") {
+			ppu_renderer = pedals::ppu::Renderer::FIFO;
+		} else if (position++ == 0) {
+			rom = argv[i];
+		} else {
+			frames = std::atoi(argv[i]);
+		}
+	}
+
+	if (!rom) {
+		std::println(stderr, "usage: {} <rom> [frames] [--fifo]", argv[0]);
+		return 1;
+	}
+
+	auto gameboy = std::make_unique<pedals::gameboy::GameBoy>(rom, ppu_renderer);
+	auto& cpu = gameboy->GetCPU();
+	auto& bus = gameboy->GetBus();
+
+	// skip the boot ROM and start from the state it leaves behind
+	bus.SetBootROMVisibility(false);
+	cpu.Reset();
+
+#if defined(PEDALS_AOT)
+	cpu.LoadPrecompiledBlocks(gameboy->GetCartridge().GetRawRef());
+#endif
+
+	auto& regs = cpu.GetRegistersRef();
+	regs.af = 0x01b0;
+	regs.bc = 0x0013;
+	regs.de = 0x00d8;
+	regs.hl = 0x014d;
+	regs.sp = 0xfffe;
+	regs.pc = 0x0100;
+
+	bus.WriteMemory(0xff40, 0x91);
+	bus.WriteMemory(0xff47, 0xfc);
+
+	const uint32_t cycles_per_frame = 70224;
+	uint64_t total_cycles = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++) {
+		total_cycles += cpu.Run(cycles_per_frame);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	double mhz = total_cycles / seconds / 1e6;
+
+	std::println("{}: {} frames, {} T-cycles in {:.3f}s", interpreter_name, frames, total_cycles, seconds);
+	std::println("{}: {:.2f} MHz ({:.1f}x realtime)", interpreter_name, mhz, mhz / 4.194304);
+
+	return 0;
+}
@@ -11,18 +11,55 @@
 #include <vector>
 #include <print>
 #include <filesystem>
+#include <variant>
+#include <optional>
+#include <fstream>
+#include <cstdlib>
 
 namespace pedals::cartridge {
+	// the MBC is picked once when the ROM is loaded, every access is a switch over these
+	// instead of a virtual call
+	using MBC = std::variant<pedals::mbc::NoMBC, pedals::mbc::MBC1, pedals::mbc::MBC3>;
+
 	class Cartridge {
 	public:
-		Cartridge(std::string_view filename) : m_Filename(filename) {
+		Cartridge(std::string_view filename) : m_Filename(filename), m_MBC(Load()) {}
+
+		uint8_t Read(uint16_t address) {
+			return std::visit([address](auto& mbc) { return mbc.Read(address); }, m_MBC);
+		}
+
+		void Write(uint16_t address, uint8_t value) {
+			std::visit([address, value](auto& mbc) { mbc.Write(address, value); }, m_MBC);
+		}
+
+		// the ROM bank currently mapped at a 0x0000-0x7fff address
+		uint32_t GetROMBank(uint16_t address) const {
+			return std::visit([address](const auto& mbc) { return mbc.GetROMBank(address); }, m_MBC);
+		}
+
+		// the bank mapped at a 0x0000-0x7fff address as a host pointer, nullptr if the file ends before it does
+		const uint8_t* GetROMBankData(uint16_t address) const {
+			size_t offset = static_cast<size_t>(GetROMBank(address)) * 0x4000;
+			if (offset + 0x4000 > m_Raw.size()) return nullptr;
+			return m_Raw.data() + offset;
+		}
+
+		std::vector<uint8_t>& GetRawRef() {
+			return m_Raw;
+		}
+
+		void ParseFile();
+
+	private:
+		// reads the ROM, opens the save file and creates the MBC the header asks for
+		MBC Load() {
 			ParseFile();
 
 			pedals::mbc::MBCFeatures features = pedals::mbc::get_mbc_features(m_Raw[0x147]);
-			std::optional<std::fstream> stream;
 
 			if (features.ram && features.battery) {
-				std::string save_filename = std::string(filename.substr(0, filename.find_last_of('.'))) + ".sav";
+				std::string save_filename = m_Filename.substr(0, m_Filename.find_last_of('.')) + ".sav";
 				bool new_save = !std::filesystem::exists(save_filename);
 
 				if (new_save) {
@@ -31,16 +68,16 @@ namespace pedals::cartridge {
 					init_save.write(zero.data(), zero.size());
 				}
 
-				stream.emplace(save_filename, std::ios::in | std::ios::out | std::ios::binary);
-				if (!stream->is_open()) {
+				m_SaveStream.emplace(save_filename, std::ios::in | std::ios::out | std::ios::binary);
+				if (!m_SaveStream->is_open()) {
 					std::println("cartridge: failed to open save file");
 				}
 			}
 			
 			switch (features.mbc) {
-				case pedals::mbc::MBCType::MBC1: m_MBC = new pedals::mbc::MBC1(m_Raw, features, stream); break;
-				case pedals::mbc::MBCType::MBC3: m_MBC = new pedals::mbc::MBC3(m_Raw, features, stream); break;
-				case pedals::mbc::MBCType::ROM: m_MBC = new pedals::mbc::NoMBC(m_Raw, features, stream); break;
+				case pedals::mbc::MBCType::MBC1: return MBC(std::in_place_type<pedals::mbc::MBC1>, m_Raw, features, m_SaveStream);
+				case pedals::mbc::MBCType::MBC3: return MBC(std::in_place_type<pedals::mbc::MBC3>, m_Raw, features, m_SaveStream);
+				case pedals::mbc::MBCType::ROM: return MBC(std::in_place_type<pedals::mbc::NoMBC>, m_Raw, features, m_SaveStream);
 
 				default: {
 					std::println("cartridge: mbc type {:02x} is unimplemented", m_Raw[0x147]);
@@ -49,24 +86,14 @@ namespace pedals::cartridge {
 			}
 		}
 
-		~Cartridge() {
-			delete m_MBC;
-		}
-
-		pedals::mbc::BaseMBC* GetMBC() {
-			return m_MBC;
-		}
-
-		std::vector<uint8_t>& GetRawRef() {
-			return m_Raw;
-		}
-
-		void ParseFile();
-
 	private:
 		std::vector<uint8_t> m_Raw;
 		std::string m_Filename;
-		pedals::mbc::BaseMBC* m_MBC;
+
+		// the MBC keeps a reference to this and writes the save back when it is destroyed, so this
+		// has to be declared before (and outlive) the MBC
+		std::optional<std::fstream> m_SaveStream;
+		MBC m_MBC;
 	};
 }
 
@@ -77,10 +77,8 @@ namespace pedals::mbc {
 		BaseMBC(const std::vector<uint8_t>& raw, MBCFeatures features, std::optional<std::fstream>& save_file)
 			: m_Raw(raw), m_Features(features), m_SaveStream(save_file) {}
 
-		virtual ~BaseMBC() = default;
-
-		virtual uint8_t Read(uint16_t) = 0;
-		virtual void Write(uint16_t, uint8_t) = 0;
+		// every MBC provides Read(), Write() and GetROMBank() (the ROM bank currently mapped at a
+		// 0x0000-0x7fff address), they are not virtual since the cartridge holds the MBC in a variant
 
 	protected:
 		const std::vector<uint8_t>& m_Raw;
@@ -93,13 +91,17 @@ namespace pedals::mbc {
 		using BaseMBC::BaseMBC;
 		
 		// TODO: make this check if the address is valid
-		uint8_t Read(uint16_t address) override {
+		uint8_t Read(uint16_t address) {
 			return m_Raw[address];
 		}
 
-		void Write(uint16_t address, uint8_t value) override {
+		void Write(uint16_t address, uint8_t value) {
 			std::println("mbc: attempted to write {:02x} -> {:04x} in rom!", value, address);
 		}
+
+		uint32_t GetROMBank(uint16_t address) const {
+			return address >> 14;
+		}
 	};
 }
 
@@ -21,7 +21,7 @@ namespace pedals::mbc {
 			}
 		}
 
-		uint8_t Read(uint16_t address) override {
+		uint8_t Read(uint16_t address) {
 			if (address < 0x4000) {
 				if (m_BankingMode == 1 && m_Raw.size() > 0x80000) {
 					uint32_t bank = m_ROMBank2 << 5;
@@ -44,7 +44,7 @@ namespace pedals::mbc {
 			return 0xff;
 		}
 
-		void Write(uint16_t address, uint8_t value) override {
+		void Write(uint16_t address, uint8_t value) {
 			if (address < 0x2000) {
 				m_RAMEnabled = ((value & 0x0f) == 0x0a) && m_Features.ram;
 			}
@@ -77,6 +77,14 @@ namespace pedals::mbc {
 			}
 		}
 
+		uint32_t GetROMBank(uint16_t address) const {
+			if (address < 0x4000) {
+				return (m_BankingMode == 1 && m_Raw.size() > 0x80000) ? (m_ROMBank2 << 5) : 0;
+			}
+
+			return m_ROMBank | (m_ROMBank2 << 5);
+		}
+
 	private:
 		uint8_t m_ROMBank = 1;
 		uint8_t m_ROMBank2 = 0;
@@ -23,7 +23,7 @@ namespace pedals::mbc {
 			}
 		}
 
-		uint8_t Read(uint16_t address) override {
+		uint8_t Read(uint16_t address) {
 			if (address <= 0x3FFF) {
 				// ROM bank 0
 				return m_Raw[address];
@@ -57,7 +57,7 @@ namespace pedals::mbc {
 			return 0xff;
 		}
 
-		void Write(uint16_t address, uint8_t value) override {
+		void Write(uint16_t address, uint8_t value) {
 			if (address <= 0x1fff) {
 				// RAM enable
 				m_RAMEnabled = (value & 0x0f) == 0x0a;
@@ -104,6 +104,10 @@ namespace pedals::mbc {
 			}
 		}
 
+		uint32_t GetROMBank(uint16_t address) const {
+			return (address < 0x4000) ? 0 : m_ROMBank;
+		}
+
 	private:
 		uint8_t m_ROMBank = 1;
 		uint8_t m_RAMBank = 0;
@@ -0,0 +1,39 @@
+#ifndef AOT_HPP
+#define AOT_HPP
+
+#include "jit.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace pedals::cpu {
+	// a block emitted by the static recompiler (tools/recompiler), keyed like the block cache
+	struct PrecompiledBlock {
+		uint32_t bank;
+		uint16_t pc;
+		CompiledBlock run;
+	};
+}
+
+// defined by the source the recompiler generates for one ROM
+namespace pedals::cpu::aot {
+	extern const PrecompiledBlock blocks[];
+	extern const size_t block_count;
+
+	// hash of the ROM the blocks were generated from, the blocks are not used for any other ROM
+	extern const uint32_t rom_hash;
+
+	// FNV-1a, shared with the recompiler
+	inline uint32_t HashROM(const std::vector<uint8_t>& rom) {
+		uint32_t hash = 0x811c9dc5;
+		for (uint8_t byte : rom) {
+			hash ^= byte;
+			hash *= 0x01000193;
+		}
+
+		return hash;
+	}
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef AOT_OPS_HPP
+#define AOT_OPS_HPP
+
+#include "cpu.hpp"
+
+#include <stdint.h>
+
+// the instructions the recompiler (tools/recompiler) writes out as plain C++, they work on the register
+// file directly and take F from SM83::ComputeFlags like the interpreter. everything that touches memory
+// or the interrupt state still goes through the instruction handlers
+namespace pedals::cpu::aot {
+	inline uint8_t ZeroFlag(uint8_t value) {
+		return (value == 0) ? Flags::Zero : 0;
+	}
+
+	// returns the sum, ADD and ADC
+	inline uint8_t Add(Registers& r, uint8_t value, uint8_t carry) {
+		uint8_t result = static_cast<uint8_t>(r.a + value + carry);
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Add, r.a, value, carry, r.f);
+		return result;
+	}
+
+	// returns the difference, SUB and SBC store it in A and CP throws it away
+	inline uint8_t Sub(Registers& r, uint8_t value, uint8_t carry) {
+		uint8_t result = static_cast<uint8_t>(r.a - value - carry);
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Sub, r.a, value, carry, r.f);
+		return result;
+	}
+
+	inline void And(Registers& r, uint8_t value) {
+		r.a &= value;
+		r.f = SM83::ComputeFlags(SM83::FlagOp::And, r.a, 0, 0, r.f);
+	}
+
+	inline void Xor(Registers& r, uint8_t value) {
+		r.a ^= value;
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Or, r.a, 0, 0, r.f);
+	}
+
+	inline void Or(Registers& r, uint8_t value) {
+		r.a |= value;
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Or, r.a, 0, 0, r.f);
+	}
+
+	inline void Inc(Registers& r, uint8_t& reg) {
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Inc, reg, 0, 0, r.f);
+		reg++;
+	}
+
+	inline void Dec(Registers& r, uint8_t& reg) {
+		r.f = SM83::ComputeFlags(SM83::FlagOp::Dec, reg, 0, 0, r.f);
+		reg--;
+	}
+
+	// Z is kept
+	inline void AddHL(Registers& r, uint16_t value) {
+		uint32_t result = r.hl + value;
+
+		uint8_t flags = 0;
+		if ((r.hl & 0xfff) + (value & 0xfff) > 0xfff) flags |= Flags::HalfCarry;
+		if (result > 0xffff) flags |= Flags::Carry;
+
+		r.hl = static_cast<uint16_t>(result);
+		r.f = (r.f & (0x0f | Flags::Zero)) | flags;
+	}
+
+	// the CB rotates and shifts by their y field (RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL), RLCA and
+	// friends are the same with Z cleared afterwards
+	inline uint8_t Shift(Registers& r, uint8_t operation, uint8_t value) {
+		uint8_t carry_in = (r.f & Flags::Carry) ? 1 : 0;
+		uint8_t result = 0;
+		uint8_t carry = 0;
+
+		switch (operation) {
+			case 0: result = static_cast<uint8_t>((value << 1) | (value >> 7)); carry = value >> 7; break;
+			case 1: result = static_cast<uint8_t>((value >> 1) | (value << 7)); carry = value & 1; break;
+			case 2: result = static_cast<uint8_t>((value << 1) | carry_in); carry = value >> 7; break;
+			case 3: result = static_cast<uint8_t>((value >> 1) | (carry_in << 7)); carry = value & 1; break;
+			case 4: result = static_cast<uint8_t>(value << 1); carry = value >> 7; break;
+			case 5: result = static_cast<uint8_t>((value >> 1) | (value & 0x80)); carry = value & 1; break;
+			case 6: result = static_cast<uint8_t>((value << 4) | (value >> 4)); break;
+			default: result = value >> 1; carry = value & 1; break;
+		}
+
+		r.f = (r.f & 0x0f) | ZeroFlag(result) | (carry ? Flags::Carry : 0);
+		return result;
+	}
+
+	// like SM83::BIT, the low bits of F are cleared too
+	inline void Bit(Registers& r, uint8_t bit, uint8_t value) {
+		r.f = (r.f & Flags::Carry) | Flags::HalfCarry | ZeroFlag(value & (1 << bit));
+	}
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "block_cache.hpp"
+
+using namespace pedals::cpu;
+
+uint8_t BlockCache::GetInstructionLength(uint8_t opcode) {
+	switch (opcode) {
+		// LD rr, nn / LD (nn), SP / JP / CALL / LD (nn), A / LD A, (nn)
+		case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+		case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda:
+		case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+		case 0xea: case 0xfa:
+			return 3;
+
+		// LD r, n / JR / STOP / ALU A, n / LDH / ADD SP, e / LD HL, SP + e / CB prefix
+		case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e:
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: case 0x10:
+		case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+		case 0xe0: case 0xf0: case 0xe8: case 0xf8: case 0xcb:
+			return 2;
+
+		default:
+			return 1;
+	}
+}
+
+// the cycles the SM83 helpers add for an instruction, conditional branches are counted as not taken
+uint8_t BlockCache::GetInstructionCycles(uint8_t opcode, uint8_t cb_opcode) {
+	uint8_t x = opcode >> 6;
+	uint8_t y = (opcode >> 3) & 7;
+	uint8_t z = opcode & 7;
+
+	if (opcode == 0xcb) {
+		if ((cb_opcode & 7) != 6) return 8;
+		return (cb_opcode >= 0x40 && cb_opcode < 0x80) ? 12 : 16;
+	}
+
+	switch (x) {
+		case 0: {
+			switch (z) {
+				case 0: {
+					if (y == 1) return 20;
+					if (y == 3) return 12;
+					if (y >= 4) return 8;
+					return 4;
+				}
+
+				case 1: return (y & 1) ? 8 : 12;
+				case 2: return 8;
+				case 3: return 8;
+				case 4: return (y == 6) ? 12 : 4;
+				case 5: return (y == 6) ? 12 : 4;
+				case 6: return (y == 6) ? 12 : 8;
+				default: return 4;
+			}
+		}
+
+		case 1: {
+			if (opcode == 0x76) return 4;
+			return (y == 6 || z == 6) ? 8 : 4;
+		}
+
+		case 2: return (z == 6) ? 8 : 4;
+
+		default: {
+			switch (opcode) {
+				case 0xc0: case 0xc8: case 0xd0: case 0xd8: return 8;
+				case 0xe0: case 0xf0: case 0xf8: return 12;
+				case 0xe8: return 16;
+
+				case 0xc1: case 0xd1: case 0xe1: case 0xf1: return 12;
+				case 0xc9: case 0xd9: return 16;
+				case 0xe9: return 4;
+				case 0xf9: return 8;
+
+				case 0xc2: case 0xca: case 0xd2: case 0xda: return 12;
+				case 0xe2: case 0xf2: return 8;
+				case 0xea: case 0xfa: return 16;
+
+				case 0xc3: return 16;
+				case 0xf3: case 0xfb: return 4;
+
+				case 0xc4: case 0xcc: case 0xd4: case 0xdc: return 12;
+
+				case 0xc5: case 0xd5: case 0xe5: case 0xf5: return 16;
+				case 0xcd: return 24;
+
+				case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe: return 8;
+				case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff: return 16;
+
+				// unused opcodes
+				default: return 0;
+			}
+		}
+	}
+}
+
+bool BlockCache::EndsBlock(uint8_t opcode) {
+	switch (opcode) {
+		// JR / JP / CALL / RET / RETI / RST
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+		case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe9:
+		case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+		case 0xc0: case 0xc8: case 0xc9: case 0xd0: case 0xd8: case 0xd9:
+		case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+
+		// HALT / STOP
+		case 0x76: case 0x10:
+
+		// unused opcodes
+		case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4: case 0xeb: case 0xec: case 0xed: case 0xf4: case 0xfc: case 0xfd:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+bool BlockCache::IsConditionalBranch(uint8_t opcode) {
+	switch (opcode) {
+		case 0x20: case 0x28: case 0x30: case 0x38:
+		case 0xc2: case 0xca: case 0xd2: case 0xda:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+bool BlockCache::IsBranch(uint8_t opcode) {
+	return IsConditionalBranch(opcode) || opcode == 0x18 || opcode == 0xc3 || opcode == 0xe9;
+}
+
+// instructions that only touch registers, jr backwards stays with the handler so the idle and copy
+// loops are still found
+bool BlockCache::IsNative(const DecodedOp& op) {
+	uint8_t x = op.opcode >> 6;
+	uint8_t y = (op.opcode >> 3) & 7;
+	uint8_t z = op.opcode & 7;
+
+	switch (x) {
+		case 0: {
+			if (op.opcode == 0x00) return true;
+			if (op.opcode == 0x18 || IsConditionalBranch(op.opcode)) return static_cast<int8_t>(op.operands[0]) >= 0;
+			if (z == 1 || z == 3) return true;
+			if (z == 4 || z == 5 || z == 6) return y != 6;
+			if (z == 7) return y != 4;
+			return false;
+		}
+
+		case 1: return y != 6 && z != 6;
+		case 2: return z != 6;
+
+		default: {
+			if (op.opcode == 0xcb) return (op.operands[0] & 7) != 6;
+			if (z == 6) return true;
+			return op.opcode == 0xc3 || op.opcode == 0xe9 || op.opcode == 0xf9 || IsConditionalBranch(op.opcode);
+		}
+	}
+}
+
+Block* BlockCache::Lookup(pedals::bus::Bus& bus, uint16_t pc) {
+	uint32_t bank;
+	uint16_t limit;
+
+	if (pc < 0x8000) {
+		// the boot ROM only runs once so it is not worth caching
+		if (pc < 0x100 && bus.IsBootROMMapped()) return nullptr;
+
+		bank = bus.GetROMBank(pc);
+		limit = (pc < 0x4000) ? 0x4000 : 0x8000;
+	}
+
+	else if (pc >= 0xc000 && pc < 0xe000) {
+		bank = RAMBank;
+		limit = 0xe000;
+	}
+
+	else if (pc >= 0xff80 && pc < 0xffff) {
+		bank = RAMBank;
+		limit = 0xffff;
+	}
+
+	// VRAM, cartridge RAM, echo RAM and I/O always go through the bus
+	else {
+		return nullptr;
+	}
+
+	uint32_t key = (bank << 16) | pc;
+
+	auto it = m_Blocks.find(key);
+	if (it != m_Blocks.end() && IsValid(it->second, bus)) {
+		return &it->second;
+	}
+
+	Block block = Decode(bus, pc, limit);
+	if (block.ops.empty()) {
+		return nullptr;
+	}
+
+	block.bank = bank;
+	block.in_ram = (bank == RAMBank);
+	block.write_stamp = bus.GetWriteCounter();
+
+	Block& cached = m_Blocks[key];
+	cached = std::move(block);
+	return &cached;
+}
+
+Block BlockCache::Decode(pedals::bus::Bus& bus, uint16_t pc, uint16_t limit) {
+	Block block;
+	block.start = pc;
+
+	uint32_t address = pc;
+	uint32_t line_end = (pc & ~(BlockLine - 1)) + BlockLine;
+
+	while (address < line_end) {
+		uint8_t opcode = bus.ReadMemory(static_cast<uint16_t>(address));
+		uint8_t length = GetInstructionLength(opcode);
+
+		// the whole instruction has to be inside the memory region
+		if (address + length > limit) {
+			break;
+		}
+
+		DecodedOp op {};
+		op.address = static_cast<uint16_t>(address);
+		op.opcode = opcode;
+		op.length = length;
+
+		for (uint8_t i = 1; i < length; i++) {
+			op.operands[i - 1] = bus.ReadMemory(static_cast<uint16_t>(address + i));
+		}
+
+		op.cycles = GetInstructionCycles(opcode, op.operands[0]);
+
+		block.ops.push_back(op);
+		block.cycles += op.cycles;
+		address += length;
+
+		if (EndsBlock(opcode)) {
+			break;
+		}
+	}
+
+	block.end = static_cast<uint16_t>(address);
+	return block;
+}
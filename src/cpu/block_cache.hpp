@@ -0,0 +1,88 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include "../peripherals/bus.hpp"
+
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include <unordered_map>
+
+namespace pedals::cpu {
+	// an instruction with its operand bytes already fetched
+	struct DecodedOp {
+		uint16_t address;
+		uint8_t opcode;
+		uint8_t length;
+
+		// T-cycles when a conditional branch is not taken
+		uint8_t cycles;
+
+		// the bytes after the opcode, including the second byte of CB instructions
+		std::array<uint8_t, 2> operands;
+	};
+
+	// straight line code up to and including the first instruction that can jump
+	struct Block {
+		std::vector<DecodedOp> ops;
+
+		uint32_t bank = 0;
+		uint16_t start = 0;
+		uint16_t end = 0;
+		uint32_t cycles = 0;
+
+		// bus write counter when the block was decoded, only used for blocks in RAM
+		uint64_t write_stamp = 0;
+		bool in_ram = false;
+
+		// how often the block has been entered from the top and its native code, used by the JIT and the precompiled blocks
+		uint32_t hits = 0;
+		void* native = nullptr;
+	};
+
+	// decoded blocks keyed by (ROM bank, pc), code in WRAM and HRAM is keyed with RAMBank
+	// and gets decoded again once any of its bytes have been written
+	class BlockCache {
+	public:
+		static constexpr uint32_t RAMBank = 0xffff;
+
+		// blocks end with the first instruction that starts in the next 64 byte line, so a block in RAM never
+		// covers more than two write stamp lines. code entered in the middle of a block (returning from an
+		// interrupt) gets back onto the same blocks as the code that ran from the top at the next line
+		static constexpr uint32_t BlockLine = 64;
+
+		// returns nullptr if the code at pc can not be cached
+		Block* Lookup(pedals::bus::Bus& bus, uint16_t pc);
+
+		bool IsValid(const Block& block, const pedals::bus::Bus& bus) const {
+			if (!block.in_ram) {
+				return true;
+			}
+
+			return bus.GetWriteStamp(block.start) <= block.write_stamp && bus.GetWriteStamp(block.end - 1) <= block.write_stamp;
+		}
+
+		void Clear() {
+			m_Blocks.clear();
+		}
+
+	public:
+		static uint8_t GetInstructionLength(uint8_t opcode);
+		static uint8_t GetInstructionCycles(uint8_t opcode, uint8_t cb_opcode);
+		static bool EndsBlock(uint8_t opcode);
+
+		static bool IsConditionalBranch(uint8_t opcode);
+		static bool IsBranch(uint8_t opcode);
+
+		// what the JIT compiles and the recompiler writes out as C++ rather than calling the handler
+		static bool IsNative(const DecodedOp& op);
+
+	private:
+		Block Decode(pedals::bus::Bus& bus, uint16_t pc, uint16_t limit);
+
+	private:
+		std::unordered_map<uint32_t, Block> m_Blocks;
+	};
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "cpu.hpp"
 #include <print>
+#include <algorithm>
 
 using namespace pedals::cpu;
 
@@ -41,12 +42,9 @@ void SM83::LD_addr(uint16_t addr, uint16_t src, uint8_t cycles) {
 }
 
 void SM83::INC(uint8_t& reg) {
-	uint8_t result = reg + 1;
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) + 1) > 0xf);
-	ClearFlag(Flags::Subtraction);
+	SetArithmeticFlags(FlagOp::Inc, reg);
 
-	reg = result;
+	reg++;
 	m_LastOpCycles += 4;
 }
 
@@ -57,24 +55,16 @@ void SM83::INC(uint16_t& reg) {
 
 void SM83::INC_addr(uint16_t addr) {
 	uint8_t val = m_Bus->ReadMemory(addr);
-	uint8_t result = val + 1;
+	SetArithmeticFlags(FlagOp::Inc, val);
 
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlagByValue(Flags::HalfCarry, ((val & 0xf) + 1) > 0xf);
-	ClearFlag(Flags::Subtraction);
-
-	m_Bus->WriteMemory(addr, result);
+	m_Bus->WriteMemory(addr, val + 1);
 	m_LastOpCycles += 12;
 }
 
 void SM83::DEC(uint8_t& reg) {
-	uint8_t result = reg - 1;
+	SetArithmeticFlags(FlagOp::Dec, reg);
 
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, (result & 0xf) == 0xf);
-	
-	reg = result;
+	reg--;
 	m_LastOpCycles += 4;
 }
 
@@ -85,23 +75,15 @@ void SM83::DEC(uint16_t& reg) {
 
 void SM83::DEC_addr(uint16_t addr) {
 	uint8_t val = m_Bus->ReadMemory(addr);
-	uint8_t result = val - 1;
-	
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, (result & 0xf) == 0xf);
+	SetArithmeticFlags(FlagOp::Dec, val);
 
-	m_Bus->WriteMemory(addr, result);
+	m_Bus->WriteMemory(addr, val - 1);
 	m_LastOpCycles += 12;
 }
 
 void SM83::XOR(uint8_t& reg, uint8_t src, uint8_t cycles) {
 	reg ^= src;
-	
-	SetFlagByValue(Flags::Zero, reg == 0);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::Or, reg);
 	
 	m_LastOpCycles += cycles;
 }
@@ -109,11 +91,7 @@ void SM83::XOR(uint8_t& reg, uint8_t src, uint8_t cycles) {
 void SM83::XOR(uint8_t& reg, uint16_t addr, uint8_t cycles) {
 	uint8_t val = m_Bus->ReadMemory(addr);
 	reg ^= val;
-	
-	SetFlagByValue(Flags::Zero, reg == 0);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::Or, reg);
 	
 	m_LastOpCycles += cycles;
 }
@@ -121,13 +99,21 @@ void SM83::XOR(uint8_t& reg, uint16_t addr, uint8_t cycles) {
 void SM83::JR(int8_t rel) {
 	m_Registers.pc += rel;
 	m_LastOpCycles += 12;
+
+	if (rel < 0 && m_AccelerateLoops) {
+		CheckLoop(m_Registers.pc - rel - 2);
+	}
 }
 
 void SM83::JR(Flags flag, bool inverse, int8_t rel) {
 	m_LastOpCycles += 8;
-	if ((m_Registers.f & flag) == (inverse ? 0 : flag)) {
+	if (GetFlag(flag) != inverse) {
 		m_Registers.pc += rel;
 		m_LastOpCycles += 4;
+
+		if (rel < 0 && m_AccelerateLoops) {
+			CheckLoop(m_Registers.pc - rel - 2);
+		}
 	}
 }
 
@@ -141,7 +127,7 @@ void SM83::CALL(uint16_t addr) {
 void SM83::CALL(Flags flag, bool inverse, uint16_t addr) {
 	m_LastOpCycles += 12;
 
-	if ((m_Registers.f & flag) == (inverse ? 0 : flag)) {
+	if (GetFlag(flag) != inverse) {
 		StackPush16(m_Registers.pc);
 		m_Registers.pc = addr;
 
@@ -188,7 +174,7 @@ void SM83::RET() {
 void SM83::RET(Flags flag, bool inverse) {
 	m_LastOpCycles += 8;
 
-	if ((m_Registers.f & flag) == (inverse ? 0 : flag)) {
+	if (GetFlag(flag) != inverse) {
 		m_Registers.pc = StackPop16();
 
 		m_LastOpCycles += 12;
@@ -196,24 +182,14 @@ void SM83::RET(Flags flag, bool inverse) {
 }
 
 void SM83::CP(uint8_t value, uint8_t cycles) {
-	uint8_t result = value - m_Registers.a;
-
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, (m_Registers.a & 0xf) < (value & 0xf));
-	SetFlagByValue(Flags::Carry, value > m_Registers.a);
+	SetArithmeticFlags(FlagOp::Sub, m_Registers.a, value);
 
 	m_LastOpCycles += cycles;
 }
 
 void SM83::CP(uint16_t addr, uint8_t cycles) {
 	uint8_t value = m_Bus->ReadMemory(addr);
-	uint8_t result = value - m_Registers.a;
-	
-	SetFlagByValue(Flags::Zero, result == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, (m_Registers.a & 0xf) < (value & 0xf));
-	SetFlagByValue(Flags::Carry, m_Registers.a < value);
+	SetArithmeticFlags(FlagOp::Sub, m_Registers.a, value);
 
 	m_LastOpCycles += cycles;
 }
@@ -226,7 +202,7 @@ void SM83::JP(uint16_t addr, uint8_t cycles) {
 void SM83::JP(Flags flag, bool inverse, uint16_t addr) {
 	m_LastOpCycles += 12;
 
-	if ((m_Registers.f & flag) == (inverse ? 0 : flag)) {
+	if (GetFlag(flag) != inverse) {
 		m_Registers.pc = addr;
 		m_LastOpCycles += 4;
 	}
@@ -254,11 +230,7 @@ void SM83::RETI() {
 void SM83::SUB(uint8_t value, uint8_t cycles) {
 	uint8_t reg = m_Registers.a;
 	m_Registers.a -= value;
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) - (value & 0xf)) < 0);
-	SetFlagByValue(Flags::Carry, reg < value);
+	SetArithmeticFlags(FlagOp::Sub, reg, value);
 
 	m_LastOpCycles += cycles;
 }
@@ -267,24 +239,15 @@ void SM83::SUB(uint16_t addr) {
 	uint8_t reg = m_Registers.a;
 	uint8_t value = m_Bus->ReadMemory(addr);
 	m_Registers.a -= value;
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) - (value & 0xf)) < 0);
-	SetFlagByValue(Flags::Carry, reg < value);
+	SetArithmeticFlags(FlagOp::Sub, reg, value);
 
 	m_LastOpCycles += 8;
 }
 
 void SM83::ADD(uint8_t value, uint8_t cycles) {
 	uint8_t reg = m_Registers.a;
-	uint16_t result = value + m_Registers.a;
-	m_Registers.a = static_cast<uint8_t>(result);
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	ClearFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) + (value & 0xf)) > 0xf);
-	SetFlagByValue(Flags::Carry, (result & 0x100) != 0);
+	m_Registers.a += value;
+	SetArithmeticFlags(FlagOp::Add, reg, value);
 
 	m_LastOpCycles += cycles;
 }
@@ -292,13 +255,8 @@ void SM83::ADD(uint8_t value, uint8_t cycles) {
 void SM83::ADD(uint16_t addr) {
 	uint8_t reg = m_Registers.a;
 	uint8_t value = m_Bus->ReadMemory(addr);
-	uint16_t result = value + m_Registers.a;
-	m_Registers.a = static_cast<uint8_t>(result);
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	ClearFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) + (value & 0xf)) > 0xf);
-	SetFlagByValue(Flags::Carry, result > 0xFF);
+	m_Registers.a += value;
+	SetArithmeticFlags(FlagOp::Add, reg, value);
 
 	m_LastOpCycles += 8;
 }
@@ -329,22 +287,14 @@ void SM83::ADD(int8_t value) {
 
 void SM83::OR(uint8_t src, uint8_t cycles) {
 	m_Registers.a |= src;
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::Or, m_Registers.a);
 
 	m_LastOpCycles += cycles;
 }
 
 void SM83::OR(uint16_t addr) {
 	m_Registers.a |= m_Bus->ReadMemory(addr);
-	
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::Or, m_Registers.a);
 
 	m_LastOpCycles += 8;
 }
@@ -359,20 +309,14 @@ void SM83::CPL() {
 
 void SM83::AND(uint8_t src, uint8_t cycles) {
 	m_Registers.a &= src;
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	SetFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::And, m_Registers.a);
 
 	m_LastOpCycles += cycles;
 }
 
 void SM83::AND(uint16_t addr) {
 	m_Registers.a &= m_Bus->ReadMemory(addr);
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	SetFlag(Flags::HalfCarry);
-	ClearFlag(Flags::Subtraction);
-	ClearFlag(Flags::Carry);
+	SetArithmeticFlags(FlagOp::And, m_Registers.a);
 
 	m_LastOpCycles += 8;
 }
@@ -386,13 +330,9 @@ void SM83::RST(uint8_t vec) {
 
 void SM83::ADC(uint8_t value, uint8_t cycles) {
 	uint8_t reg = m_Registers.a;
-	uint16_t result = value + m_Registers.a + GetFlag(Flags::Carry);
-	m_Registers.a = static_cast<uint8_t>(result);
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	ClearFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) + (value & 0xf) + GetFlag(Flags::Carry)) > 0xf);
-	SetFlagByValue(Flags::Carry, (result & 0x100) != 0);
+	uint8_t carry = GetFlag(Flags::Carry);
+	m_Registers.a = reg + value + carry;
+	SetArithmeticFlags(FlagOp::Add, reg, value, carry);
 
 	m_LastOpCycles += cycles;
 }
@@ -496,14 +436,9 @@ void SM83::SCF() {
 
 void SM83::SBC(uint8_t value, uint8_t cycles) {
 	uint8_t reg = m_Registers.a;
-	int result = m_Registers.a - value - GetFlag(Flags::Carry);
-
-	m_Registers.a = static_cast<uint8_t>(result);
-
-	SetFlagByValue(Flags::Zero, m_Registers.a == 0);
-	SetFlag(Flags::Subtraction);
-	SetFlagByValue(Flags::HalfCarry, ((reg & 0xf) - (value & 0xf) - GetFlag(Flags::Carry)) < 0);
-	SetFlagByValue(Flags::Carry, result < 0);
+	uint8_t carry = GetFlag(Flags::Carry);
+	m_Registers.a = reg - value - carry;
+	SetArithmeticFlags(FlagOp::Sub, reg, value, carry);
 
 	m_LastOpCycles += cycles;
 }
@@ -544,7 +479,7 @@ void SM83::BIT(uint8_t bit, uint16_t addr) {
 }
 
 void SM83::RL(uint8_t& reg) {
-	uint8_t carry = (m_Registers.f & Flags::Carry) ? 1 : 0;
+	uint8_t carry = GetFlag(Flags::Carry) ? 1 : 0;
 	SetFlagByValue(Flags::Carry, (reg >> 7) & 1);
 
 	reg <<= 1;
@@ -559,7 +494,7 @@ void SM83::RL(uint8_t& reg) {
 
 void SM83::RL(uint16_t addr) {
 	uint8_t val = m_Bus->ReadMemory(addr);
-	uint8_t carry = (m_Registers.f & Flags::Carry) ? 1 : 0;
+	uint8_t carry = GetFlag(Flags::Carry) ? 1 : 0;
 	SetFlagByValue(Flags::Carry, (val >> 7) & 1);
 
 	val <<= 1;
@@ -797,299 +732,315 @@ void SM83::SRA(uint16_t addr) {
 void SM83::Reset() {
 	m_Registers.pc = 0x0000;
 	m_Registers.f = 0x00;
+	m_Loop = {};
+	m_Fetch = {};
+}
+
+template <uint8_t index>
+inline uint8_t& SM83::Reg8() {
+	static_assert(index != 6, "operand 6 is (HL) and has to be handled by the caller");
+
+	if constexpr (index == 0) return m_Registers.b;
+	else if constexpr (index == 1) return m_Registers.c;
+	else if constexpr (index == 2) return m_Registers.d;
+	else if constexpr (index == 3) return m_Registers.e;
+	else if constexpr (index == 4) return m_Registers.h;
+	else if constexpr (index == 5) return m_Registers.l;
+	else return m_Registers.a;
+}
+
+template <uint8_t index>
+inline uint16_t& SM83::Reg16() {
+	if constexpr (index == 0) return m_Registers.bc;
+	else if constexpr (index == 1) return m_Registers.de;
+	else if constexpr (index == 2) return m_Registers.hl;
+	else return m_Registers.sp;
+}
+
+// the opcode tables are laid out as a grid, so each handler is generated from the bits of its opcode
+// x = opcode[7:6], y = opcode[5:3], z = opcode[2:0], p = y[2:1], q = y[0]
+// see https://gbdev.io/gb-opcodes/optables
+template <uint8_t opcode>
+void SM83::Op() {
+	constexpr uint8_t x = opcode >> 6;
+	constexpr uint8_t y = (opcode >> 3) & 7;
+	constexpr uint8_t z = opcode & 7;
+	constexpr uint8_t p = y >> 1;
+	constexpr uint8_t q = y & 1;
+
+	// NZ, Z, NC and C conditions
+	constexpr Flags cc_flag = (y & 0b10) ? Flags::Carry : Flags::Zero;
+	constexpr bool cc_inverse = (y & 0b01) == 0;
+
+	if constexpr (x == 0) {
+		if constexpr (z == 0) {
+			if constexpr (y == 0) m_LastOpCycles += 4;
+			else if constexpr (y == 1) LD_addr(Fetch16(), m_Registers.sp, 20);
+			else if constexpr (y == 2) { STOP(); Fetch8(); }
+			else if constexpr (y == 3) JR(Fetch8());
+			else JR(cc_flag, cc_inverse, Fetch8());
+		}
+
+		else if constexpr (z == 1) {
+			if constexpr (q == 0) LD(Reg16<p>(), Fetch16(), 12);
+			else ADDhl(Reg16<p>());
+		}
+
+		else if constexpr (z == 2) {
+			if constexpr (opcode == 0x02) LD(m_Registers.bc, m_Registers.a, 8);
+			else if constexpr (opcode == 0x12) LD(m_Registers.de, m_Registers.a, 8);
+			else if constexpr (opcode == 0x22) LD(m_Registers.hl++, m_Registers.a, 8);
+			else if constexpr (opcode == 0x32) LD(m_Registers.hl--, m_Registers.a, 8);
+			else if constexpr (opcode == 0x0a) LD(m_Registers.a, m_Registers.bc, 8);
+			else if constexpr (opcode == 0x1a) LD(m_Registers.a, m_Registers.de, 8);
+			else if constexpr (opcode == 0x2a) LD(m_Registers.a, m_Registers.hl++, 8);
+			else LD(m_Registers.a, m_Registers.hl--, 8);
+		}
+
+		else if constexpr (z == 3) {
+			if constexpr (q == 0) INC(Reg16<p>());
+			else DEC(Reg16<p>());
+		}
+
+		else if constexpr (z == 4) {
+			if constexpr (y == 6) INC_addr(m_Registers.hl);
+			else INC(Reg8<y>());
+		}
+
+		else if constexpr (z == 5) {
+			if constexpr (y == 6) DEC_addr(m_Registers.hl);
+			else DEC(Reg8<y>());
+		}
+
+		else if constexpr (z == 6) {
+			if constexpr (y == 6) LD(m_Registers.hl, Fetch8(), 12);
+			else LD(Reg8<y>(), Fetch8(), 8);
+		}
+
+		else {
+			if constexpr (y == 0) RLCA();
+			else if constexpr (y == 1) RRCA();
+			else if constexpr (y == 2) RLA();
+			else if constexpr (y == 3) RRA();
+			else if constexpr (y == 4) DAA();
+			else if constexpr (y == 5) CPL();
+			else if constexpr (y == 6) SCF();
+			else CCF();
+		}
+	}
+
+	// LD r, r' (with HALT in place of LD (HL), (HL))
+	else if constexpr (x == 1) {
+		if constexpr (opcode == 0x76) HALT();
+		else if constexpr (z == 6) LD(Reg8<y>(), m_Registers.hl, 8);
+		else if constexpr (y == 6) LD(m_Registers.hl, Reg8<z>(), 8);
+		else LD(Reg8<y>(), Reg8<z>(), 4);
+	}
+
+	// ALU A, r
+	else if constexpr (x == 2) {
+		if constexpr (z == 6) {
+			if constexpr (y == 0) ADD(m_Registers.hl);
+			else if constexpr (y == 1) ADC(m_Bus->ReadMemory(m_Registers.hl), 8);
+			else if constexpr (y == 2) SUB(m_Registers.hl);
+			else if constexpr (y == 3) SBC(m_Bus->ReadMemory(m_Registers.hl), 8);
+			else if constexpr (y == 4) AND(m_Registers.hl);
+			else if constexpr (y == 5) XOR(m_Registers.a, m_Registers.hl, 8);
+			else if constexpr (y == 6) OR(m_Registers.hl);
+			else CP(m_Registers.hl, 8);
+		}
+
+		else {
+			if constexpr (y == 0) ADD(Reg8<z>(), 4);
+			else if constexpr (y == 1) ADC(Reg8<z>(), 4);
+			else if constexpr (y == 2) SUB(Reg8<z>(), 4);
+			else if constexpr (y == 3) SBC(Reg8<z>(), 4);
+			else if constexpr (y == 4) AND(Reg8<z>(), 4);
+			else if constexpr (y == 5) XOR(m_Registers.a, Reg8<z>(), 4);
+			else if constexpr (y == 6) OR(Reg8<z>(), 4);
+			else CP(Reg8<z>(), 4);
+		}
+	}
+
+	else {
+		if constexpr (z == 0) {
+			if constexpr (y < 4) RET(cc_flag, cc_inverse);
+			else if constexpr (y == 4) LD(0xff00 + Fetch8(), m_Registers.a, 12);
+			else if constexpr (y == 5) ADD(static_cast<int8_t>(Fetch8()));
+			else if constexpr (y == 6) LD(m_Registers.a, static_cast<uint16_t>(0xff00 + Fetch8()), 12);
+			else LD(m_Registers.hl, m_Registers.sp, Fetch8(), 12);
+		}
+
+		else if constexpr (z == 1) {
+			if constexpr (opcode == 0xf1) POP_af();
+			else if constexpr (q == 0) POP(Reg16<p>());
+			else if constexpr (p == 0) RET();
+			else if constexpr (p == 1) RETI();
+			else if constexpr (p == 2) JP(m_Registers.hl, 4);
+			else LD(m_Registers.sp, m_Registers.hl, 8);
+		}
+
+		else if constexpr (z == 2) {
+			if constexpr (y < 4) JP(cc_flag, cc_inverse, Fetch16());
+			else if constexpr (y == 4) LD(0xff00 + m_Registers.c, m_Registers.a, 8);
+			else if constexpr (y == 5) LD(Fetch16(), m_Registers.a, 16);
+			else if constexpr (y == 6) LD(m_Registers.a, static_cast<uint16_t>(0xff00 + m_Registers.c), 8);
+			else LD(m_Registers.a, m_Bus->ReadMemory(Fetch16()), 16);
+		}
+
+		else if constexpr (z == 3) {
+			if constexpr (y == 0) JP(Fetch16(), 16);
+			else if constexpr (y == 1) CBStep();
+			else if constexpr (y == 6) DI();
+			else if constexpr (y == 7) EI();
+		}
+
+		else if constexpr (z == 4) {
+			if constexpr (y < 4) CALL(cc_flag, cc_inverse, Fetch16());
+		}
+
+		else if constexpr (z == 5) {
+			if constexpr (opcode == 0xf5) PUSH(m_Registers.af);
+			else if constexpr (q == 0) PUSH(Reg16<p>());
+			else if constexpr (p == 0) CALL(Fetch16());
+		}
+
+		else if constexpr (z == 6) {
+			if constexpr (y == 0) ADD(Fetch8(), 8);
+			else if constexpr (y == 1) ADC(Fetch8(), 8);
+			else if constexpr (y == 2) SUB(Fetch8(), 8);
+			else if constexpr (y == 3) SBC(Fetch8(), 8);
+			else if constexpr (y == 4) AND(Fetch8(), 8);
+			else if constexpr (y == 5) XOR(m_Registers.a, Fetch8(), 8);
+			else if constexpr (y == 6) OR(Fetch8(), 8);
+			else CP(Fetch8(), 8);
+		}
+
+		else {
+			RST(y * 8);
+		}
+	}
+}
+
+// the CB table is a regular grid of operation x bit x register
+template <uint8_t opcode>
+void SM83::CBOp() {
+	constexpr uint8_t y = (opcode >> 3) & 7;
+	constexpr uint8_t z = opcode & 7;
+
+	// (HL) is passed as the 16-bit pair so the memory overloads get picked
+	auto& operand = [this]() -> auto& {
+		if constexpr (z == 6) return m_Registers.hl;
+		else return Reg8<z>();
+	}();
+
+	if constexpr (opcode < 0x40) {
+		if constexpr (y == 0) RLC(operand);
+		else if constexpr (y == 1) RRC(operand);
+		else if constexpr (y == 2) RL(operand);
+		else if constexpr (y == 3) RR(operand);
+		else if constexpr (y == 4) SLA(operand);
+		else if constexpr (y == 5) SRA(operand);
+		else if constexpr (y == 6) SWAP(operand);
+		else SRL(operand);
+	}
+
+	else if constexpr (opcode < 0x80) BIT(y, operand);
+	else if constexpr (opcode < 0xc0) RES(y, operand);
+	else SET(y, operand);
+}
+
+template <size_t... opcodes>
+constexpr std::array<SM83::OpHandler, 256> SM83::MakeOpTable(std::index_sequence<opcodes...>) {
+	return { &SM83::RunOp<opcodes>... };
+}
+
+template <size_t... opcodes>
+constexpr std::array<SM83::OpHandler, 256> SM83::MakeCBTable(std::index_sequence<opcodes...>) {
+	return { &SM83::RunCBOp<opcodes>... };
 }
 
+constinit const std::array<SM83::OpHandler, 256> SM83::s_OpTable = SM83::MakeOpTable(std::make_index_sequence<256>());
+constinit const std::array<SM83::OpHandler, 256> SM83::s_CBTable = SM83::MakeCBTable(std::make_index_sequence<256>());
+
 void SM83::CBStep() {
 	uint8_t opcode = Fetch8();
-	switch (opcode) {
-		// BIT
-		case 0x40: BIT(0, m_Registers.b); break;
-		case 0x41: BIT(0, m_Registers.c); break;
-		case 0x42: BIT(0, m_Registers.d); break;
-		case 0x43: BIT(0, m_Registers.e); break;
-		case 0x44: BIT(0, m_Registers.h); break;
-		case 0x45: BIT(0, m_Registers.l); break;
-		case 0x46: BIT(0, m_Registers.hl); break;
-		case 0x47: BIT(0, m_Registers.a); break;
-		case 0x48: BIT(1, m_Registers.b); break;
-		case 0x49: BIT(1, m_Registers.c); break;
-		case 0x4a: BIT(1, m_Registers.d); break;
-		case 0x4b: BIT(1, m_Registers.e); break;
-		case 0x4c: BIT(1, m_Registers.h); break;
-		case 0x4d: BIT(1, m_Registers.l); break;
-		case 0x4e: BIT(1, m_Registers.hl); break;
-		case 0x4f: BIT(1, m_Registers.a); break;
-		case 0x50: BIT(2, m_Registers.b); break;
-		case 0x51: BIT(2, m_Registers.c); break;
-		case 0x52: BIT(2, m_Registers.d); break;
-		case 0x53: BIT(2, m_Registers.e); break;
-		case 0x54: BIT(2, m_Registers.h); break;
-		case 0x55: BIT(2, m_Registers.l); break;
-		case 0x56: BIT(2, m_Registers.hl); break;
-		case 0x57: BIT(2, m_Registers.a); break;
-		case 0x58: BIT(3, m_Registers.b); break;
-		case 0x59: BIT(3, m_Registers.c); break;
-		case 0x5a: BIT(3, m_Registers.d); break;
-		case 0x5b: BIT(3, m_Registers.e); break;
-		case 0x5c: BIT(3, m_Registers.h); break;
-		case 0x5d: BIT(3, m_Registers.l); break;
-		case 0x5e: BIT(3, m_Registers.hl); break;
-		case 0x5f: BIT(3, m_Registers.a); break;
-		case 0x60: BIT(4, m_Registers.b); break;
-		case 0x61: BIT(4, m_Registers.c); break;
-		case 0x62: BIT(4, m_Registers.d); break;
-		case 0x63: BIT(4, m_Registers.e); break;
-		case 0x64: BIT(4, m_Registers.h); break;
-		case 0x65: BIT(4, m_Registers.l); break;
-		case 0x66: BIT(4, m_Registers.hl); break;
-		case 0x67: BIT(4, m_Registers.a); break;
-		case 0x68: BIT(5, m_Registers.b); break;
-		case 0x69: BIT(5, m_Registers.c); break;
-		case 0x6a: BIT(5, m_Registers.d); break;
-		case 0x6b: BIT(5, m_Registers.e); break;
-		case 0x6c: BIT(5, m_Registers.h); break;
-		case 0x6d: BIT(5, m_Registers.l); break;
-		case 0x6e: BIT(5, m_Registers.hl); break;
-		case 0x6f: BIT(5, m_Registers.a); break;
-		case 0x70: BIT(6, m_Registers.b); break;
-		case 0x71: BIT(6, m_Registers.c); break;
-		case 0x72: BIT(6, m_Registers.d); break;
-		case 0x73: BIT(6, m_Registers.e); break;
-		case 0x74: BIT(6, m_Registers.h); break;
-		case 0x75: BIT(6, m_Registers.l); break;
-		case 0x76: BIT(6, m_Registers.hl); break;
-		case 0x77: BIT(6, m_Registers.a); break;
-		case 0x78: BIT(7, m_Registers.b); break;
-		case 0x79: BIT(7, m_Registers.c); break;
-		case 0x7a: BIT(7, m_Registers.d); break;
-		case 0x7b: BIT(7, m_Registers.e); break;
-		case 0x7c: BIT(7, m_Registers.h); break;
-		case 0x7d: BIT(7, m_Registers.l); break;
-		case 0x7e: BIT(7, m_Registers.hl); break;
-		case 0x7f: BIT(7, m_Registers.a); break;
-
-		// RL
-		case 0x10: RL(m_Registers.b); break;
-		case 0x11: RL(m_Registers.c); break;
-		case 0x12: RL(m_Registers.d); break;
-		case 0x13: RL(m_Registers.e); break;
-		case 0x14: RL(m_Registers.h); break;
-		case 0x15: RL(m_Registers.l); break;
-		case 0x16: RL(m_Registers.hl); break;
-		case 0x17: RL(m_Registers.a); break;
-
-		// SWAP
-		case 0x30: SWAP(m_Registers.b); break;
-		case 0x31: SWAP(m_Registers.c); break;
-		case 0x32: SWAP(m_Registers.d); break;
-		case 0x33: SWAP(m_Registers.e); break;
-		case 0x34: SWAP(m_Registers.h); break;
-		case 0x35: SWAP(m_Registers.l); break;
-		case 0x36: SWAP(m_Registers.hl); break;
-		case 0x37: SWAP(m_Registers.a); break;
-
-		// RES
-		case 0x80: RES(0, m_Registers.b); break;
-		case 0x81: RES(0, m_Registers.c); break;
-		case 0x82: RES(0, m_Registers.d); break;
-		case 0x83: RES(0, m_Registers.e); break;
-		case 0x84: RES(0, m_Registers.h); break;
-		case 0x85: RES(0, m_Registers.l); break;
-		case 0x86: RES(0, m_Registers.hl); break;
-		case 0x87: RES(0, m_Registers.a); break;
-		case 0x88: RES(1, m_Registers.b); break;
-		case 0x89: RES(1, m_Registers.c); break;
-		case 0x8a: RES(1, m_Registers.d); break;
-		case 0x8b: RES(1, m_Registers.e); break;
-		case 0x8c: RES(1, m_Registers.h); break;
-		case 0x8d: RES(1, m_Registers.l); break;
-		case 0x8e: RES(1, m_Registers.hl); break;
-		case 0x8f: RES(1, m_Registers.a); break;
-		case 0x90: RES(2, m_Registers.b); break;
-		case 0x91: RES(2, m_Registers.c); break;
-		case 0x92: RES(2, m_Registers.d); break;
-		case 0x93: RES(2, m_Registers.e); break;
-		case 0x94: RES(2, m_Registers.h); break;
-		case 0x95: RES(2, m_Registers.l); break;
-		case 0x96: RES(2, m_Registers.hl); break;
-		case 0x97: RES(2, m_Registers.a); break;
-		case 0x98: RES(3, m_Registers.b); break;
-		case 0x99: RES(3, m_Registers.c); break;
-		case 0x9a: RES(3, m_Registers.d); break;
-		case 0x9b: RES(3, m_Registers.e); break;
-		case 0x9c: RES(3, m_Registers.h); break;
-		case 0x9d: RES(3, m_Registers.l); break;
-		case 0x9e: RES(3, m_Registers.hl); break;
-		case 0x9f: RES(3, m_Registers.a); break;
-		case 0xa0: RES(4, m_Registers.b); break;
-		case 0xa1: RES(4, m_Registers.c); break;
-		case 0xa2: RES(4, m_Registers.d); break;
-		case 0xa3: RES(4, m_Registers.e); break;
-		case 0xa4: RES(4, m_Registers.h); break;
-		case 0xa5: RES(4, m_Registers.l); break;
-		case 0xa6: RES(4, m_Registers.hl); break;
-		case 0xa7: RES(4, m_Registers.a); break;
-		case 0xa8: RES(5, m_Registers.b); break;
-		case 0xa9: RES(5, m_Registers.c); break;
-		case 0xaa: RES(5, m_Registers.d); break;
-		case 0xab: RES(5, m_Registers.e); break;
-		case 0xac: RES(5, m_Registers.h); break;
-		case 0xad: RES(5, m_Registers.l); break;
-		case 0xae: RES(5, m_Registers.hl); break;
-		case 0xaf: RES(5, m_Registers.a); break;
-		case 0xb0: RES(6, m_Registers.b); break;
-		case 0xb1: RES(6, m_Registers.c); break;
-		case 0xb2: RES(6, m_Registers.d); break;
-		case 0xb3: RES(6, m_Registers.e); break;
-		case 0xb4: RES(6, m_Registers.h); break;
-		case 0xb5: RES(6, m_Registers.l); break;
-		case 0xb6: RES(6, m_Registers.hl); break;
-		case 0xb7: RES(6, m_Registers.a); break;
-		case 0xb8: RES(7, m_Registers.b); break;
-		case 0xb9: RES(7, m_Registers.c); break;
-		case 0xba: RES(7, m_Registers.d); break;
-		case 0xbb: RES(7, m_Registers.e); break;
-		case 0xbc: RES(7, m_Registers.h); break;
-		case 0xbd: RES(7, m_Registers.l); break;
-		case 0xbe: RES(7, m_Registers.hl); break;
-		case 0xbf: RES(7, m_Registers.a); break;
-
-		// SET
-		case 0xc0: SET(0, m_Registers.b); break;
-		case 0xc1: SET(0, m_Registers.c); break;
-		case 0xc2: SET(0, m_Registers.d); break;
-		case 0xc3: SET(0, m_Registers.e); break;
-		case 0xc4: SET(0, m_Registers.h); break;
-		case 0xc5: SET(0, m_Registers.l); break;
-		case 0xc6: SET(0, m_Registers.hl); break;
-		case 0xc7: SET(0, m_Registers.a); break;
-		case 0xc8: SET(1, m_Registers.b); break;
-		case 0xc9: SET(1, m_Registers.c); break;
-		case 0xca: SET(1, m_Registers.d); break;
-		case 0xcb: SET(1, m_Registers.e); break;
-		case 0xcc: SET(1, m_Registers.h); break;
-		case 0xcd: SET(1, m_Registers.l); break;
-		case 0xce: SET(1, m_Registers.hl); break;
-		case 0xcf: SET(1, m_Registers.a); break;
-		case 0xd0: SET(2, m_Registers.b); break;
-		case 0xd1: SET(2, m_Registers.c); break;
-		case 0xd2: SET(2, m_Registers.d); break;
-		case 0xd3: SET(2, m_Registers.e); break;
-		case 0xd4: SET(2, m_Registers.h); break;
-		case 0xd5: SET(2, m_Registers.l); break;
-		case 0xd6: SET(2, m_Registers.hl); break;
-		case 0xd7: SET(2, m_Registers.a); break;
-		case 0xd8: SET(3, m_Registers.b); break;
-		case 0xd9: SET(3, m_Registers.c); break;
-		case 0xda: SET(3, m_Registers.d); break;
-		case 0xdb: SET(3, m_Registers.e); break;
-		case 0xdc: SET(3, m_Registers.h); break;
-		case 0xdd: SET(3, m_Registers.l); break;
-		case 0xde: SET(3, m_Registers.hl); break;
-		case 0xdf: SET(3, m_Registers.a); break;
-		case 0xe0: SET(4, m_Registers.b); break;
-		case 0xe1: SET(4, m_Registers.c); break;
-		case 0xe2: SET(4, m_Registers.d); break;
-		case 0xe3: SET(4, m_Registers.e); break;
-		case 0xe4: SET(4, m_Registers.h); break;
-		case 0xe5: SET(4, m_Registers.l); break;
-		case 0xe6: SET(4, m_Registers.hl); break;
-		case 0xe7: SET(4, m_Registers.a); break;
-		case 0xe8: SET(5, m_Registers.b); break;
-		case 0xe9: SET(5, m_Registers.c); break;
-		case 0xea: SET(5, m_Registers.d); break;
-		case 0xeb: SET(5, m_Registers.e); break;
-		case 0xec: SET(5, m_Registers.h); break;
-		case 0xed: SET(5, m_Registers.l); break;
-		case 0xee: SET(5, m_Registers.hl); break;
-		case 0xef: SET(5, m_Registers.a); break;
-		case 0xf0: SET(6, m_Registers.b); break;
-		case 0xf1: SET(6, m_Registers.c); break;
-		case 0xf2: SET(6, m_Registers.d); break;
-		case 0xf3: SET(6, m_Registers.e); break;
-		case 0xf4: SET(6, m_Registers.h); break;
-		case 0xf5: SET(6, m_Registers.l); break;
-		case 0xf6: SET(6, m_Registers.hl); break;
-		case 0xf7: SET(6, m_Registers.a); break;
-		case 0xf8: SET(7, m_Registers.b); break;
-		case 0xf9: SET(7, m_Registers.c); break;
-		case 0xfa: SET(7, m_Registers.d); break;
-		case 0xfb: SET(7, m_Registers.e); break;
-		case 0xfc: SET(7, m_Registers.h); break;
-		case 0xfd: SET(7, m_Registers.l); break;
-		case 0xfe: SET(7, m_Registers.hl); break;
-		case 0xff: SET(7, m_Registers.a); break;
-
-		// SLA
-		case 0x20: SLA(m_Registers.b); break;
-		case 0x21: SLA(m_Registers.c); break;
-		case 0x22: SLA(m_Registers.d); break;
-		case 0x23: SLA(m_Registers.e); break;
-		case 0x24: SLA(m_Registers.h); break;
-		case 0x25: SLA(m_Registers.l); break;
-		case 0x26: SLA(m_Registers.hl); break;
-		case 0x27: SLA(m_Registers.a); break;
-
-		// RLC
-		case 0x00: RLC(m_Registers.b); break;
-		case 0x01: RLC(m_Registers.c); break;
-		case 0x02: RLC(m_Registers.d); break;
-		case 0x03: RLC(m_Registers.e); break;
-		case 0x04: RLC(m_Registers.h); break;
-		case 0x05: RLC(m_Registers.l); break;
-		case 0x06: RLC(m_Registers.hl); break;
-		case 0x07: RLC(m_Registers.a); break;
-
-		// SRL
-		case 0x38: SRL(m_Registers.b); break;
-		case 0x39: SRL(m_Registers.c); break;
-		case 0x3a: SRL(m_Registers.d); break;
-		case 0x3b: SRL(m_Registers.e); break;
-		case 0x3c: SRL(m_Registers.h); break;
-		case 0x3d: SRL(m_Registers.l); break;
-		case 0x3e: SRL(m_Registers.hl); break;
-		case 0x3f: SRL(m_Registers.a); break;
-
-		// RR
-		case 0x18: RR(m_Registers.b); break;
-		case 0x19: RR(m_Registers.c); break;
-		case 0x1a: RR(m_Registers.d); break;
-		case 0x1b: RR(m_Registers.e); break;
-		case 0x1c: RR(m_Registers.h); break;
-		case 0x1d: RR(m_Registers.l); break;
-		case 0x1e: RR(m_Registers.hl); break;
-		case 0x1f: RR(m_Registers.a); break;
-
-		// RRC
-		case 0x08: RRC(m_Registers.b); break;
-		case 0x09: RRC(m_Registers.c); break;
-		case 0x0a: RRC(m_Registers.d); break;
-		case 0x0b: RRC(m_Registers.e); break;
-		case 0x0c: RRC(m_Registers.h); break;
-		case 0x0d: RRC(m_Registers.l); break;
-		case 0x0e: RRC(m_Registers.hl); break;
-		case 0x0f: RRC(m_Registers.a); break;
-
-		// SRA
-		case 0x28: SRA(m_Registers.b); break;
-		case 0x29: SRA(m_Registers.c); break;
-		case 0x2a: SRA(m_Registers.d); break;
-		case 0x2b: SRA(m_Registers.e); break;
-		case 0x2c: SRA(m_Registers.h); break;
-		case 0x2d: SRA(m_Registers.l); break;
-		case 0x2e: SRA(m_Registers.hl); break;
-		case 0x2f: SRA(m_Registers.a); break;
-
-		default: break;
+	s_CBTable[opcode](*this);
+}
+
+const DecodedOp* SM83::NextDecodedOp() {
+	// a bank switch or the boot ROM being unmapped can change the code under the current block
+	if (m_Bus->GetMappingGeneration() != m_BlockGeneration) {
+		m_BlockGeneration = m_Bus->GetMappingGeneration();
+		m_Block = nullptr;
+	}
+
+	bool in_block = m_Block != nullptr
+		&& m_BlockIndex < m_Block->ops.size()
+		&& m_Block->ops[m_BlockIndex].address == m_Registers.pc
+		&& m_BlockCache.IsValid(*m_Block, *m_Bus);
+
+	if (!in_block) {
+		m_Block = m_BlockCache.Lookup(*m_Bus, m_Registers.pc);
+		m_BlockIndex = 0;
+
+		if (m_Block == nullptr) {
+			return nullptr;
+		}
+	}
+
+	return &m_Block->ops[m_BlockIndex++];
+}
+
+uint8_t SM83::FetchOpcode() {
+	const DecodedOp* op = NextDecodedOp();
+	if (op == nullptr) {
+		return Fetch8();
 	}
+
+	m_Registers.pc++;
+	m_DecodedOperands = op->operands.data();
+	return op->opcode;
 }
 
-uint8_t SM83::Step() {
+inline uint32_t SM83::StepFast() {
+	m_LastOpCycles = 0;
+	s_OpTable[FetchOpcode()](*this);
+	m_DecodedOperands = nullptr;
+
+	if (m_IME && (m_Bus->GetIE() & m_Bus->GetIF() & 0x1f) != 0) HandleInterrupts();
+	return m_LastOpCycles;
+}
+
+void SM83::UpdateFetchRegion() {
+	m_Fetch = m_Bus->GetFetchRegion(m_Registers.pc);
+	m_FetchGeneration = m_Bus->GetMappingGeneration();
+}
+
+uint32_t SM83::Step(uint32_t budget) {
 	m_LastOpCycles = 0;
 
 	bool enable_interrupts = m_EIqueued;
 	m_EIqueued = false;
 
+	// idle or copy loop, the jr that closed it has already run so pc is back at the start of the loop
+	if (m_State == State::Idle || m_State == State::Copy) {
+		bool idle = m_State == State::Idle;
+		m_State = State::Normal;
+
+		// an interrupt requested while the jr was ticked is taken after the next instruction, which has to run normally
+		bool interrupt_pending = m_IME && (m_Bus->GetIE() & m_Bus->GetIF() & 0x1f) != 0;
+
+		uint32_t skipped = 0;
+		if (!enable_interrupts && !interrupt_pending) {
+			skipped = idle ? SkipIdleLoop(budget) : RunCopyLoop(budget);
+		}
+
+		if (skipped > 0) {
+			return skipped;
+		}
+	}
+
 	// halt state
 	if (m_State == State::Halt) {
 		if ((m_Bus->GetIE() & m_Bus->GetIF() & 0x1f) != 0) {
@@ -1104,7 +1055,10 @@ uint8_t SM83::Step() {
 			return m_LastOpCycles;
 		}
 
-		return 4;
+		// every 4 T-cycles before the next PPU or timer event would be another halted step,
+		// so run all of them at once but no further than the caller wants to go
+		uint32_t idle_steps = std::min(m_Bus->CyclesUntilNextEvent() / 4, (budget + 3) / 4);
+		return std::max(idle_steps, 1u) * 4;
 	}
 
 	// stop state
@@ -1117,331 +1071,20 @@ uint8_t SM83::Step() {
 		return 4;
 	}
 
-	uint8_t opcode = Fetch8();
+	uint8_t opcode;
 	if (m_DoubleRead) {
+		opcode = Fetch8();
 		m_Registers.pc--;
 		m_DoubleRead = false;
+	} else {
+		opcode = FetchOpcode();
 	}
 
-	switch (opcode) {
-		// NOP
-		case 0x00: m_LastOpCycles += 4; break;
-
-		// LD
-		case 0x01: LD(m_Registers.bc, Fetch16(), 12); break;
-		case 0x02: LD(m_Registers.bc, m_Registers.a, 8); break;
-		case 0x06: LD(m_Registers.b, Fetch8(), 8); break;
-		case 0x08: LD_addr(Fetch16(), m_Registers.sp, 20); break;
-		case 0x0a: LD(m_Registers.a, m_Registers.bc, 8); break;
-		case 0x0e: LD(m_Registers.c, Fetch8(), 8); break;
-		case 0x11: LD(m_Registers.de, Fetch16(), 12); break;
-		case 0x12: LD(m_Registers.de, m_Registers.a, 8); break;
-		case 0x16: LD(m_Registers.d, Fetch8(), 8); break;
-		case 0x1a: LD(m_Registers.a, m_Registers.de, 8); break;
-		case 0x1e: LD(m_Registers.e, Fetch8(), 8); break;
-		case 0x21: LD(m_Registers.hl, Fetch16(), 12); break;
-		case 0x22: LD(m_Registers.hl++, m_Registers.a, 8); break;
-		case 0x26: LD(m_Registers.h, Fetch8(), 8); break;
-		case 0x2a: LD(m_Registers.a, m_Registers.hl++, 8); break;
-		case 0x2e: LD(m_Registers.l, Fetch8(), 8); break;
-		case 0x31: LD(m_Registers.sp, Fetch16(), 12); break;
-		case 0x32: LD(m_Registers.hl--, m_Registers.a, 8); break;
-		case 0x36: LD(m_Registers.hl, Fetch8(), 12); break;
-		case 0x3a: LD(m_Registers.a, m_Registers.hl--, 8); break;
-		case 0x3e: LD(m_Registers.a, Fetch8(), 8); break;
-		case 0x40: LD(m_Registers.b, m_Registers.b, 4); break;
-		case 0x41: LD(m_Registers.b, m_Registers.c, 4); break;
-		case 0x42: LD(m_Registers.b, m_Registers.d, 4); break;
-		case 0x43: LD(m_Registers.b, m_Registers.e, 4); break;
-		case 0x44: LD(m_Registers.b, m_Registers.h, 4); break;
-		case 0x45: LD(m_Registers.b, m_Registers.l, 4); break;
-		case 0x46: LD(m_Registers.b, m_Registers.hl, 8); break;
-		case 0x47: LD(m_Registers.b, m_Registers.a, 4); break;
-		case 0x48: LD(m_Registers.c, m_Registers.b, 4); break;
-		case 0x49: LD(m_Registers.c, m_Registers.c, 4); break;
-		case 0x4a: LD(m_Registers.c, m_Registers.d, 4); break;
-		case 0x4b: LD(m_Registers.c, m_Registers.e, 4); break;
-		case 0x4c: LD(m_Registers.c, m_Registers.h, 4); break;
-		case 0x4d: LD(m_Registers.c, m_Registers.l, 4); break;
-		case 0x4e: LD(m_Registers.c, m_Registers.hl, 8); break;
-		case 0x4f: LD(m_Registers.c, m_Registers.a, 4); break;
-		case 0x50: LD(m_Registers.d, m_Registers.b, 4); break;
-		case 0x51: LD(m_Registers.d, m_Registers.c, 4); break;
-		case 0x52: LD(m_Registers.d, m_Registers.d, 4); break;
-		case 0x53: LD(m_Registers.d, m_Registers.e, 4); break;
-		case 0x54: LD(m_Registers.d, m_Registers.h, 4); break;
-		case 0x55: LD(m_Registers.d, m_Registers.l, 4); break;
-		case 0x56: LD(m_Registers.d, m_Registers.hl, 8); break;
-		case 0x57: LD(m_Registers.d, m_Registers.a, 4); break;
-		case 0x58: LD(m_Registers.e, m_Registers.b, 4); break;
-		case 0x59: LD(m_Registers.e, m_Registers.c, 4); break;
-		case 0x5a: LD(m_Registers.e, m_Registers.d, 4); break;
-		case 0x5b: LD(m_Registers.e, m_Registers.e, 4); break;
-		case 0x5c: LD(m_Registers.e, m_Registers.h, 4); break;
-		case 0x5d: LD(m_Registers.e, m_Registers.l, 4); break;
-		case 0x5e: LD(m_Registers.e, m_Registers.hl, 8); break;
-		case 0x5f: LD(m_Registers.e, m_Registers.a, 4); break;
-		case 0x60: LD(m_Registers.h, m_Registers.b, 4); break;
-		case 0x61: LD(m_Registers.h, m_Registers.c, 4); break;
-		case 0x62: LD(m_Registers.h, m_Registers.d, 4); break;
-		case 0x63: LD(m_Registers.h, m_Registers.e, 4); break;
-		case 0x64: LD(m_Registers.h, m_Registers.h, 4); break;
-		case 0x65: LD(m_Registers.h, m_Registers.l, 4); break;
-		case 0x66: LD(m_Registers.h, m_Registers.hl, 8); break;
-		case 0x67: LD(m_Registers.h, m_Registers.a, 4); break;
-		case 0x68: LD(m_Registers.l, m_Registers.b, 4); break;
-		case 0x69: LD(m_Registers.l, m_Registers.c, 4); break;
-		case 0x6a: LD(m_Registers.l, m_Registers.d, 4); break;
-		case 0x6b: LD(m_Registers.l, m_Registers.e, 4); break;
-		case 0x6c: LD(m_Registers.l, m_Registers.h, 4); break;
-		case 0x6d: LD(m_Registers.l, m_Registers.l, 4); break;
-		case 0x6e: LD(m_Registers.l, m_Registers.hl, 8); break;
-		case 0x6f: LD(m_Registers.l, m_Registers.a, 4); break;
-		case 0x70: LD(m_Registers.hl, m_Registers.b, 8); break;
-		case 0x71: LD(m_Registers.hl, m_Registers.c, 8); break;
-		case 0x72: LD(m_Registers.hl, m_Registers.d, 8); break;
-		case 0x73: LD(m_Registers.hl, m_Registers.e, 8); break;
-		case 0x74: LD(m_Registers.hl, m_Registers.h, 8); break;
-		case 0x75: LD(m_Registers.hl, m_Registers.l, 8); break;
-		case 0x77: LD(m_Registers.hl, m_Registers.a, 8); break;
-		case 0x78: LD(m_Registers.a, m_Registers.b, 4); break;
-		case 0x79: LD(m_Registers.a, m_Registers.c, 4); break;
-		case 0x7a: LD(m_Registers.a, m_Registers.d, 4); break;
-		case 0x7b: LD(m_Registers.a, m_Registers.e, 4); break;
-		case 0x7c: LD(m_Registers.a, m_Registers.h, 4); break;
-		case 0x7d: LD(m_Registers.a, m_Registers.l, 4); break;
-		case 0x7e: LD(m_Registers.a, m_Registers.hl, 8); break;
-		case 0x7f: LD(m_Registers.a, m_Registers.a, 4); break;
-		case 0xea: LD(Fetch16(), m_Registers.a, 16); break;
-		case 0xf8: LD(m_Registers.hl, m_Registers.sp, Fetch8(), 12); break;
-		case 0xf9: LD(m_Registers.sp, m_Registers.hl, 8); break;
-		case 0xfa: LD(m_Registers.a, m_Bus->ReadMemory(Fetch16()), 16); break;
-
-		// INC
-		case 0x03: INC(m_Registers.bc); break;
-		case 0x04: INC(m_Registers.b); break;
-		case 0x0c: INC(m_Registers.c); break;
-		case 0x13: INC(m_Registers.de); break;
-		case 0x14: INC(m_Registers.d); break;
-		case 0x1c: INC(m_Registers.e); break;
-		case 0x23: INC(m_Registers.hl); break;
-		case 0x24: INC(m_Registers.h); break;
-		case 0x2c: INC(m_Registers.l); break;
-		case 0x33: INC(m_Registers.sp); break;
-		case 0x34: INC_addr(m_Registers.hl); break;
-		case 0x3c: INC(m_Registers.a); break;
-
-		// DEC
-		case 0x05: DEC(m_Registers.b); break;
-		case 0x0b: DEC(m_Registers.bc); break;
-		case 0x0d: DEC(m_Registers.c); break;
-		case 0x15: DEC(m_Registers.d); break;
-		case 0x1b: DEC(m_Registers.de); break;
-		case 0x1d: DEC(m_Registers.e); break;
-		case 0x25: DEC(m_Registers.h); break;
-		case 0x2b: DEC(m_Registers.hl); break;
-		case 0x2d: DEC(m_Registers.l); break;
-		case 0x35: DEC_addr(m_Registers.hl); break;
-		case 0x3b: DEC(m_Registers.sp); break;
-		case 0x3d: DEC(m_Registers.a); break;
-
-		// XOR
-		case 0xa8: XOR(m_Registers.a, m_Registers.b, 4); break;
-		case 0xa9: XOR(m_Registers.a, m_Registers.c, 4); break;
-		case 0xaa: XOR(m_Registers.a, m_Registers.d, 4); break;
-		case 0xab: XOR(m_Registers.a, m_Registers.e, 4); break;
-		case 0xac: XOR(m_Registers.a, m_Registers.h, 4); break;
-		case 0xad: XOR(m_Registers.a, m_Registers.l, 4); break;
-		case 0xae: XOR(m_Registers.a, m_Registers.hl, 8); break;
-		case 0xaf: XOR(m_Registers.a, m_Registers.a, 4); break;
-		case 0xee: XOR(m_Registers.a, Fetch8(), 8); break;
-
-		// JR
-		case 0x18: JR(Fetch8()); break;
-		case 0x20: JR(Flags::Zero, true, Fetch8()); break;
-		case 0x28: JR(Flags::Zero, false, Fetch8()); break;
-		case 0x30: JR(Flags::Carry, true, Fetch8()); break;
-		case 0x38: JR(Flags::Carry, false, Fetch8()); break;
-
-		// LDH
-		case 0xe0: LD(0xff00 + Fetch8(), m_Registers.a, 12); break;
-		case 0xe2: LD(0xff00 + m_Registers.c, m_Registers.a, 8); break;
-		case 0xf0: LD(m_Registers.a, static_cast<uint16_t>(0xff00 + Fetch8()), 12); break;
-		case 0xf2: LD(m_Registers.a, static_cast<uint16_t>(0xff00 + m_Registers.c), 8); break;
-
-		// CALL
-		case 0xc4: CALL(Flags::Zero, true, Fetch16()); break;
-		case 0xcc: CALL(Flags::Zero, false, Fetch16()); break;
-		case 0xcd: CALL(Fetch16()); break;
-		case 0xd4: CALL(Flags::Carry, true, Fetch16()); break;
-		case 0xdc: CALL(Flags::Carry, false, Fetch16()); break;
-
-		// PUSH
-		case 0xc5: PUSH(m_Registers.bc); break;
-		case 0xd5: PUSH(m_Registers.de); break;
-		case 0xe5: PUSH(m_Registers.hl); break;
-		case 0xf5: PUSH(m_Registers.af); break;
-
-		// RLA
-		case 0x17: RLA(); break;
-
-		// POP
-		case 0xc1: POP(m_Registers.bc); break;
-		case 0xd1: POP(m_Registers.de); break;
-		case 0xe1: POP(m_Registers.hl); break;
-		case 0xf1: POP_af(); break;
-
-		// RET
-		case 0xc0: RET(Flags::Zero, true); break;
-		case 0xc8: RET(Flags::Zero, false); break;
-		case 0xc9: RET(); break;
-		case 0xd0: RET(Flags::Carry, true); break;
-		case 0xd8: RET(Flags::Carry, false); break;
-
-		// CP
-		case 0xb8: CP(m_Registers.b, 4); break;
-		case 0xb9: CP(m_Registers.c, 4); break;
-		case 0xba: CP(m_Registers.d, 4); break;
-		case 0xbb: CP(m_Registers.e, 4); break;
-		case 0xbc: CP(m_Registers.h, 4); break;
-		case 0xbd: CP(m_Registers.l, 4); break;
-		case 0xbe: CP(m_Registers.hl, 8); break;
-		case 0xbf: CP(m_Registers.a, 4); break;
-		case 0xfe: CP(Fetch8(), 8); break;
-
-		// JP
-		case 0xc2: JP(Flags::Zero, true, Fetch16()); break;
-		case 0xc3: JP(Fetch16(), 16); break;
-		case 0xca: JP(Flags::Zero, false, Fetch16()); break;
-		case 0xd2: JP(Flags::Carry, true, Fetch16()); break;
-		case 0xda: JP(Flags::Carry, false, Fetch16()); break;
-		case 0xe9: JP(m_Registers.hl, 4); break;
-
-		// DI
-		case 0xf3: DI(); break;
-
-		// EI
-		case 0xfb: EI(); break;
-
-		// SUB
-		case 0x90: SUB(m_Registers.b, 4); break;
-		case 0x91: SUB(m_Registers.c, 4); break;
-		case 0x92: SUB(m_Registers.d, 4); break;
-		case 0x93: SUB(m_Registers.e, 4); break;
-		case 0x94: SUB(m_Registers.h, 4); break;
-		case 0x95: SUB(m_Registers.l, 4); break;
-		case 0x96: SUB(m_Registers.hl); break;
-		case 0x97: SUB(m_Registers.a, 4); break;
-		case 0xd6: SUB(Fetch8(), 8); break;
-
-		// ADD
-		case 0x09: ADDhl(m_Registers.bc); break;
-		case 0x19: ADDhl(m_Registers.de); break;
-		case 0x29: ADDhl(m_Registers.hl); break;
-		case 0x39: ADDhl(m_Registers.sp); break;
-		case 0x80: ADD(m_Registers.b, 4); break;
-		case 0x81: ADD(m_Registers.c, 4); break;
-		case 0x82: ADD(m_Registers.d, 4); break;
-		case 0x83: ADD(m_Registers.e, 4); break;
-		case 0x84: ADD(m_Registers.h, 4); break;
-		case 0x85: ADD(m_Registers.l, 4); break;
-		case 0x86: ADD(m_Registers.hl); break;
-		case 0x87: ADD(m_Registers.a, 4); break;
-		case 0xc6: ADD(Fetch8(), 8); break;
-		case 0xe8: ADD(static_cast<int8_t>(Fetch8())); break;
-
-		// OR
-		case 0xb0: OR(m_Registers.b, 4); break;
-		case 0xb1: OR(m_Registers.c, 4); break;
-		case 0xb2: OR(m_Registers.d, 4); break;
-		case 0xb3: OR(m_Registers.e, 4); break;
-		case 0xb4: OR(m_Registers.h, 4); break;
-		case 0xb5: OR(m_Registers.l, 4); break;
-		case 0xb6: OR(m_Registers.hl); break;
-		case 0xb7: OR(m_Registers.a, 4); break;
-		case 0xf6: OR(Fetch8(), 8); break;
-
-		// CPL
-		case 0x2f: CPL(); break;
-
-		// AND
-		case 0xa0: AND(m_Registers.b, 4); break;
-		case 0xa1: AND(m_Registers.c, 4); break;
-		case 0xa2: AND(m_Registers.d, 4); break;
-		case 0xa3: AND(m_Registers.e, 4); break;
-		case 0xa4: AND(m_Registers.h, 4); break;
-		case 0xa5: AND(m_Registers.l, 4); break;
-		case 0xa6: AND(m_Registers.hl); break;
-		case 0xa7: AND(m_Registers.a, 4); break;
-		case 0xe6: AND(Fetch8(), 8); break;
-
-		// RST
-		case 0xc7: RST(0x00); break;
-		case 0xcf: RST(0x08); break;
-		case 0xd7: RST(0x10); break;
-		case 0xdf: RST(0x18); break;
-		case 0xe7: RST(0x20); break;
-		case 0xef: RST(0x28); break;
-		case 0xf7: RST(0x30); break;
-		case 0xff: RST(0x38); break;
-
-		// ADC
-		case 0x88: ADC(m_Registers.b, 4); break;
-		case 0x89: ADC(m_Registers.c, 4); break;
-		case 0x8a: ADC(m_Registers.d, 4); break;
-		case 0x8b: ADC(m_Registers.e, 4); break;
-		case 0x8c: ADC(m_Registers.h, 4); break;
-		case 0x8d: ADC(m_Registers.l, 4); break;
-		case 0x8e: ADC(m_Bus->ReadMemory(m_Registers.hl), 8); break;
-		case 0x8f: ADC(m_Registers.a, 4); break;
-		case 0xce: ADC(Fetch8(), 8); break;
-
-		// HALT
-		case 0x76: HALT(); break;
-
-		// RETI
-		case 0xd9: RETI(); break;
-
-		// RLCA
-		case 0x07: RLCA(); break;
-
-		// DAA
-		case 0x27: DAA(); break;
-
-		// RRA
-		case 0x1f: RRA(); break;
-
-		// CCF
-		case 0x3f: CCF(); break;
-
-		// STOP
-		case 0x10: STOP(); Fetch8(); break;
-
-		// SCF
-		case 0x37: SCF(); break;
-
-		// SBC
-		case 0x98: SBC(m_Registers.b, 4); break;
-		case 0x99: SBC(m_Registers.c, 4); break;
-		case 0x9a: SBC(m_Registers.d, 4); break;
-		case 0x9b: SBC(m_Registers.e, 4); break;
-		case 0x9c: SBC(m_Registers.h, 4); break;
-		case 0x9d: SBC(m_Registers.l, 4); break;
-		case 0x9e: SBC(m_Bus->ReadMemory(m_Registers.hl), 8); break;
-		case 0x9f: SBC(m_Registers.a, 4); break;
-		case 0xde: SBC(Fetch8(), 8); break;
-
-		// RRCA
-		case 0x0f: RRCA(); break;
-
-		// CB prefix
-		case 0xcb: CBStep(); break;
-		
-		default: break;
-	}
+	s_OpTable[opcode](*this);
+	m_DecodedOperands = nullptr;
 
 	// handle any interrupts
-	HandleInterrupts();
+	if (m_IME && (m_Bus->GetIE() & m_Bus->GetIF() & 0x1f) != 0) HandleInterrupts();
 
 	// set the IME if it is queued
 	if (enable_interrupts) {
@@ -1489,4 +1132,540 @@ void SM83::HandleInterrupts() {
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+// reads that give the same value until the CPU writes something or the next PPU or timer event,
+// the joypad only changes between frames
+static bool is_stable_read(uint16_t address) {
+	if (address < 0xa000) return true;
+	if (address >= 0xc000 && address < 0xfea0) return true;
+	if (address >= 0xff80) return true;
+
+	return address == 0xff00 || address == 0xff0f || (address >= 0xff40 && address <= 0xff4b && address != 0xff46);
+}
+
+static bool is_ppu_register(uint16_t address) {
+	return address >= 0xff40 && address <= 0xff4b;
+}
+
+void SM83::CheckLoop(uint16_t jr_address) {
+	uint16_t start = m_Registers.pc;
+	uint64_t now = m_Bus->GetCycles();
+	uint64_t writes = m_Bus->GetWriteCounter();
+	uint32_t generation = m_Bus->GetMappingGeneration();
+
+	Loop& loop = m_Loop;
+
+	// only scan the loop again if it is a different one or its code could have been overwritten
+	bool same_loop = loop.start == start && loop.end == jr_address && loop.generation == generation;
+	if (!same_loop || (loop.in_ram && loop.writes != writes)) {
+		loop = {};
+		loop.start = start;
+		loop.end = jr_address;
+		loop.generation = generation;
+		loop.in_ram = start >= 0x8000;
+
+		if (!MatchCopyLoop(loop)) {
+			loop.cycles = ScanIdleLoop(start, jr_address, loop.reads_hl, loop.reads_ppu);
+			loop.kind = (loop.cycles != 0) ? LoopKind::Idle : LoopKind::None;
+		}
+
+		same_loop = false;
+	}
+
+	if (loop.kind != LoopKind::Idle) {
+		if (loop.kind != LoopKind::None) {
+			m_State = State::Copy;
+		}
+
+		loop.writes = writes;
+		return;
+	}
+
+	// the last iteration ran straight through without anything being written and ended up in the
+	// same state it started in, so the next ones will too until something changes what it reads,
+	// which must not have happened since that iteration started reading
+	bool unchanged = same_loop
+		&& now - loop.stamp == loop.cycles
+		&& now + m_LastOpCycles <= loop.quiet_until
+		&& writes == loop.writes
+		&& m_Registers.af == loop.registers.af
+		&& m_Registers.bc == loop.registers.bc
+		&& m_Registers.de == loop.registers.de
+		&& m_Registers.hl == loop.registers.hl
+		&& m_Registers.sp == loop.registers.sp;
+
+	if (unchanged && (!loop.reads_hl || is_stable_read(m_Registers.hl))) {
+		m_State = State::Idle;
+	}
+
+	loop.stamp = now;
+	loop.quiet_until = now + CyclesUntilLoopInputChanges();
+	loop.writes = writes;
+	loop.registers = m_Registers;
+}
+
+// returns the T-cycles of one iteration if the loop body only reads, 0 otherwise
+uint32_t SM83::ScanIdleLoop(uint16_t start, uint16_t end, bool& reads_hl, bool& reads_ppu) {
+	if (end - start > 16) {
+		return 0;
+	}
+
+	uint32_t cycles = 12;
+	bool writes_hl = false;
+	reads_hl = false;
+	reads_ppu = false;
+
+	uint16_t address = start;
+	while (address < end) {
+		uint8_t opcode = m_Bus->ReadMemory(address);
+		uint8_t length = BlockCache::GetInstructionLength(opcode);
+		uint8_t operand = (length > 1) ? m_Bus->ReadMemory(address + 1) : 0;
+
+		uint8_t x = opcode >> 6;
+		uint8_t y = (opcode >> 3) & 7;
+		uint8_t z = opcode & 7;
+
+		// register only instructions, LD r, r' and ALU A, r including the (hl) forms that read
+		bool allowed = (opcode == 0x00)
+			|| (x == 0 && (z == 4 || z == 5 || z == 6) && y != 6)
+			|| (x == 0 && z == 7)
+			|| (x == 1 && y != 6)
+			|| (x == 2)
+			|| (x == 3 && z == 6);
+
+		if (allowed) {
+			if ((x == 1 || x == 2) && z == 6) reads_hl = true;
+			if (((x == 0 && z != 7) || x == 1) && (y == 4 || y == 5)) writes_hl = true;
+		} else if (opcode == 0xcb) {
+			uint8_t cb_x = operand >> 6;
+			uint8_t cb_z = operand & 7;
+
+			// only BIT reads (hl) without writing it back
+			if (cb_z == 6) {
+				if (cb_x != 1) return 0;
+				reads_hl = true;
+			} else if (cb_x != 1 && (cb_z == 4 || cb_z == 5)) {
+				writes_hl = true;
+			}
+		} else if (opcode == 0xf0) {
+			if (!is_stable_read(0xff00 | operand)) return 0;
+			if (is_ppu_register(0xff00 | operand)) reads_ppu = true;
+		} else if (opcode == 0xfa) {
+			uint16_t target = (m_Bus->ReadMemory(address + 2) << 8) | operand;
+			if (!is_stable_read(target)) return 0;
+			if (is_ppu_register(target)) reads_ppu = true;
+		} else {
+			return 0;
+		}
+
+		cycles += BlockCache::GetInstructionCycles(opcode, operand);
+		address += length;
+	}
+
+	// the last instruction has to end right at the jr
+	if (address != end || (reads_hl && writes_hl)) {
+		return 0;
+	}
+
+	return cycles;
+}
+
+// how many T-cycles pass before anything the idle loop reads could change
+uint32_t SM83::CyclesUntilLoopInputChanges() {
+	uint32_t cycles = m_Bus->CyclesUntilNextEvent();
+
+	if (m_Loop.reads_ppu || (m_Loop.reads_hl && is_ppu_register(m_Registers.hl))) {
+		cycles = std::min(cycles, m_Bus->CyclesUntilPPUActive());
+	}
+
+	return cycles;
+}
+
+uint32_t SM83::SkipIdleLoop(uint32_t budget) {
+	// an interrupt was taken right after the jr or the debugger moved pc
+	if (m_Registers.pc != m_Loop.start) {
+		return 0;
+	}
+
+	// whole iterations that finish before the PPU or the timer can change anything the loop reads
+	uint32_t iterations = std::min(CyclesUntilLoopInputChanges(), budget) / m_Loop.cycles;
+	uint32_t cycles = iterations * m_Loop.cycles;
+
+	m_Loop.stamp += cycles;
+	return cycles;
+}
+
+bool SM83::MatchCopyLoop(Loop& loop) {
+	uint16_t length = loop.end - loop.start;
+	if (m_Bus->ReadMemory(loop.end) != 0x20 || (length != 2 && length != 4 && length != 6)) {
+		return false;
+	}
+
+	std::array<uint8_t, 6> body {};
+	for (uint16_t i = 0; i < length; i++) {
+		body[i] = m_Bus->ReadMemory(loop.start + i);
+	}
+
+	// ld (hl+), a or ld (hl-), a counting down b, c, d or e
+	if (length == 2) {
+		bool dec_counter = body[1] == 0x05 || body[1] == 0x0d || body[1] == 0x15 || body[1] == 0x1d;
+		if ((body[0] != 0x22 && body[0] != 0x32) || !dec_counter) {
+			return false;
+		}
+
+		loop.kind = LoopKind::Fill;
+		loop.cycles = 8 + 4 + 12;
+		loop.dec_opcode = body[1];
+		loop.hl_step = (body[0] == 0x22) ? 1 : -1;
+		return true;
+	}
+
+	// ld a, (hl+) / ld (de), a or ld a, (de) / ld (hl+), a, then inc de
+	bool hl_source = body[0] == 0x2a && body[1] == 0x12;
+	bool de_source = body[0] == 0x1a && body[1] == 0x22;
+	if ((!hl_source && !de_source) || body[2] != 0x13) {
+		return false;
+	}
+
+	loop.hl_source = hl_source;
+
+	// dec b or dec c
+	if (length == 4) {
+		if (body[3] != 0x05 && body[3] != 0x0d) {
+			return false;
+		}
+
+		loop.kind = LoopKind::Copy;
+		loop.cycles = 8 + 8 + 8 + 4 + 12;
+		loop.dec_opcode = body[3];
+		return true;
+	}
+
+	// dec bc / ld a, b / or c
+	if (body[3] != 0x0b || body[4] != 0x78 || body[5] != 0xb1) {
+		return false;
+	}
+
+	loop.kind = LoopKind::Copy16;
+	loop.cycles = 8 + 8 + 8 + 8 + 4 + 4 + 12;
+	return true;
+}
+
+// runs the iterations of a copy or fill loop that finish before the next event (and before the PPU
+// next reads VRAM) at once, nothing can look at the memory in between so only the end result and the
+// time have to match
+uint32_t SM83::RunCopyLoop(uint32_t budget) {
+	const Loop& loop = m_Loop;
+	if (m_Registers.pc != loop.start) {
+		return 0;
+	}
+
+	uint8_t* counter = nullptr;
+	switch (loop.dec_opcode) {
+		case 0x05: counter = &m_Registers.b; break;
+		case 0x0d: counter = &m_Registers.c; break;
+		case 0x15: counter = &m_Registers.d; break;
+		case 0x1d: counter = &m_Registers.e; break;
+	}
+
+	uint32_t remaining = (loop.kind == LoopKind::Copy16) ? m_Registers.bc : *counter;
+
+	uint16_t source = loop.hl_source ? m_Registers.hl : m_Registers.de;
+	uint16_t destination = (loop.kind == LoopKind::Fill || !loop.hl_source) ? m_Registers.hl : m_Registers.de;
+
+	uint32_t window = std::min(m_Bus->CyclesUntilNextEvent(), budget);
+	if (destination >= 0x8000 && destination < 0xa000) {
+		window = std::min(window, m_Bus->CyclesUntilPPUActive());
+	}
+
+	// the last iteration falls through the jr, that one is left to the interpreter
+	uint32_t iterations = window / loop.cycles;
+	iterations = std::min(iterations, (remaining > 0) ? remaining - 1 : 0);
+
+	if (iterations == 0) {
+		return 0;
+	}
+
+	// code in RAM that would be overwritten has to run the slow way
+	if (loop.in_ram) {
+		uint32_t first = (loop.hl_step < 0) ? destination - iterations + 1 : destination;
+		uint32_t last = first + iterations - 1;
+
+		if (first <= loop.end + 1u && last >= loop.start) {
+			return 0;
+		}
+	}
+
+	uint16_t done = (loop.kind == LoopKind::Fill)
+		? m_Bus->FillMemory(destination, loop.hl_step, m_Registers.a, static_cast<uint16_t>(iterations))
+		: m_Bus->CopyMemory(destination, source, static_cast<uint16_t>(iterations));
+
+	if (done == 0) {
+		return 0;
+	}
+
+	if (loop.kind == LoopKind::Fill) {
+		m_Registers.hl += loop.hl_step * done;
+	} else {
+		m_Registers.hl += done;
+		m_Registers.de += done;
+		m_Registers.a = m_Bus->ReadMemory(destination + done - 1);
+	}
+
+	// the flags are the ones the last dec (or the or c) set
+	if (loop.kind == LoopKind::Copy16) {
+		m_Registers.bc -= done;
+		m_Registers.a = m_Registers.b | m_Registers.c;
+		SetArithmeticFlags(FlagOp::Or, m_Registers.a);
+	} else {
+		*counter -= done;
+		SetArithmeticFlags(FlagOp::Dec, *counter + 1);
+	}
+
+	return done * loop.cycles;
+}
+#if defined(PEDALS_JIT) || defined(PEDALS_AOT)
+
+// instructions of compiled blocks that are not done natively run through their interpreter handler
+// and are finished exactly like Step() does so the timing stays the same
+bool SM83::StartCompiledOp(JitContext* context, const DecodedOp* op) {
+	// native instructions before this one have only been counted
+	if (context->pending != 0) {
+		m_Bus->Tick(context->pending);
+		context->pending = 0;
+	}
+
+	m_LastOpCycles = 0;
+
+	bool enable_interrupts = m_EIqueued;
+	m_EIqueued = false;
+
+	m_Registers.pc++;
+	m_DecodedOperands = op->operands.data();
+	return enable_interrupts;
+}
+
+bool SM83::FinishCompiledOp(JitContext* context, const DecodedOp* op, bool enable_interrupts) {
+	m_DecodedOperands = nullptr;
+
+	HandleInterrupts();
+	if (enable_interrupts) {
+		m_IME = true;
+	}
+
+	m_Bus->Tick(m_LastOpCycles);
+	context->elapsed += m_LastOpCycles;
+
+	// leave when the budget is used up, the CPU halted, something jumped or the MBC switched banks
+	bool exit = context->elapsed >= context->cycles
+		|| m_State != State::Normal
+		|| m_DoubleRead
+		|| m_Registers.pc != op->address + op->length
+		|| m_Bus->GetMappingGeneration() != context->generation;
+
+	if (!exit) {
+		UpdateNativeBudget(context);
+	}
+
+	return exit;
+}
+
+template <uint8_t opcode>
+bool SM83::JitOp(SM83* cpu, JitContext* context, const DecodedOp* op) {
+	bool enable_interrupts = cpu->StartCompiledOp(context, op);
+	cpu->Op<opcode>();
+	return cpu->FinishCompiledOp(context, op, enable_interrupts);
+}
+
+template <size_t... opcodes>
+constexpr std::array<JitHandler, 256> SM83::MakeJitTable(std::index_sequence<opcodes...>) {
+	return { &SM83::JitOp<opcodes>... };
+}
+
+constinit const std::array<JitHandler, 256> SM83::s_JitTable = SM83::MakeJitTable(std::make_index_sequence<256>());
+
+// native instructions skip everything FinishCompiledOp() does, that is only the same as long as no
+// event comes up, the budget does not run out and no interrupt is about to be taken
+void SM83::UpdateNativeBudget(JitContext* context) {
+	if (m_EIqueued || (m_IME && (m_Bus->GetIE() & m_Bus->GetIF() & 0x1f) != 0)) {
+		context->budget = 0;
+		return;
+	}
+
+	context->budget = std::min(context->cycles - context->elapsed - 1, m_Bus->CyclesUntilNextEvent());
+}
+
+#if defined(PEDALS_AOT)
+bool SM83::LoadPrecompiledBlocks(const std::vector<uint8_t>& rom) {
+	if (aot::HashROM(rom) != aot::rom_hash) {
+		std::println("cpu: the precompiled blocks were generated from a different rom, using the interpreter");
+		return false;
+	}
+
+	for (size_t i = 0; i < aot::block_count; i++) {
+		const PrecompiledBlock& block = aot::blocks[i];
+		m_Precompiled[(block.bank << 16) | block.pc] = block.run;
+	}
+
+	InvalidateBlockCache();
+	return true;
+}
+#endif
+
+CompiledBlock SM83::FindCompiledBlock(Block& block) {
+#if defined(PEDALS_AOT)
+	if (block.native == nullptr && !block.in_ram) {
+		auto it = m_Precompiled.find((block.bank << 16) | block.start);
+		if (it != m_Precompiled.end()) {
+			block.native = reinterpret_cast<void*>(it->second);
+		}
+	}
+#endif
+
+#if defined(PEDALS_JIT)
+	// the compiled code gets to the registers through the cpu pointer it is called with
+	auto offset = [this](const void* member) {
+		return static_cast<int32_t>(reinterpret_cast<uintptr_t>(member) - reinterpret_cast<uintptr_t>(this));
+	};
+
+	JitTarget target = { &s_JitTable, offset(&m_Registers) };
+
+	return m_JIT.GetOrCompile(block, target);
+#else
+	return reinterpret_cast<CompiledBlock>(block.native);
+#endif
+}
+
+uint32_t SM83::Run(uint32_t cycles) {
+	JitContext context { 0, cycles, 0, 0, 0 };
+
+	// blocks are only looked up when pc is not already inside the one the interpreter is running
+	auto in_block = [this]() {
+		return m_Block != nullptr
+			&& m_BlockIndex < m_Block->ops.size()
+			&& m_Block->ops[m_BlockIndex].address == m_Registers.pc;
+	};
+
+	while (context.elapsed < cycles) {
+		// only ROM is ever compiled, anything else is left to the interpreter's own lookup
+		if (m_Registers.pc < 0x8000 && m_State == State::Normal && !m_DoubleRead && !in_block()) {
+#if defined(PEDALS_JIT)
+			// running out of code space flushes everything, nothing compiled is running at this point
+			if (m_JIT.IsFull()) {
+				InvalidateBlockCache();
+			}
+#endif
+
+			Block* block = m_BlockCache.Lookup(*m_Bus, m_Registers.pc);
+			CompiledBlock compiled = (block != nullptr) ? FindCompiledBlock(*block) : nullptr;
+
+			if (compiled != nullptr) {
+				m_Block = nullptr;
+				context.generation = m_Bus->GetMappingGeneration();
+				UpdateNativeBudget(&context);
+				compiled(this, &context);
+
+				if (context.pending != 0) {
+					m_Bus->Tick(context.pending);
+					context.pending = 0;
+				}
+
+				continue;
+			}
+
+			m_Block = block;
+			m_BlockIndex = 0;
+		}
+
+		// outside ROM there is nothing to look up, the interpreter keeps going until pc is back
+		uint32_t elapsed = context.elapsed;
+
+		do {
+			uint32_t step_cycles = CanStepFast() ? StepFast() : Step(cycles - elapsed);
+			m_Bus->Tick(step_cycles);
+			elapsed += step_cycles;
+		} while (elapsed < cycles && m_Registers.pc >= 0x8000);
+
+		context.elapsed = elapsed;
+	}
+
+	return context.elapsed;
+}
+
+#elif defined(PEDALS_THREADED_INTERPRETER)
+
+// every opcode as a 0x.. literal, used to generate the labels for the threaded interpreter
+#define PEDALS_OPCODE_ROW(X, hi) \
+	X(0x##hi##0) X(0x##hi##1) X(0x##hi##2) X(0x##hi##3) X(0x##hi##4) X(0x##hi##5) X(0x##hi##6) X(0x##hi##7) \
+	X(0x##hi##8) X(0x##hi##9) X(0x##hi##a) X(0x##hi##b) X(0x##hi##c) X(0x##hi##d) X(0x##hi##e) X(0x##hi##f)
+
+#define PEDALS_OPCODES(X) \
+	PEDALS_OPCODE_ROW(X, 0) PEDALS_OPCODE_ROW(X, 1) PEDALS_OPCODE_ROW(X, 2) PEDALS_OPCODE_ROW(X, 3) \
+	PEDALS_OPCODE_ROW(X, 4) PEDALS_OPCODE_ROW(X, 5) PEDALS_OPCODE_ROW(X, 6) PEDALS_OPCODE_ROW(X, 7) \
+	PEDALS_OPCODE_ROW(X, 8) PEDALS_OPCODE_ROW(X, 9) PEDALS_OPCODE_ROW(X, a) PEDALS_OPCODE_ROW(X, b) \
+	PEDALS_OPCODE_ROW(X, c) PEDALS_OPCODE_ROW(X, d) PEDALS_OPCODE_ROW(X, e) PEDALS_OPCODE_ROW(X, f)
+
+// finishes the current instruction the same way Step() does and jumps straight into the next handler,
+// halt/stop and the halt bug are left to Step()
+#define PEDALS_DISPATCH() \
+	m_DecodedOperands = nullptr; \
+	HandleInterrupts(); \
+	if (enable_interrupts) m_IME = true; \
+	m_Bus->Tick(m_LastOpCycles); \
+	elapsed += m_LastOpCycles; \
+	if (elapsed >= cycles || m_State != State::Normal || m_DoubleRead) goto slow; \
+	m_LastOpCycles = 0; \
+	enable_interrupts = m_EIqueued; \
+	m_EIqueued = false; \
+	goto *handlers[FetchOpcode()];
+
+#define PEDALS_HANDLER_LABEL(op) &&op_##op,
+#define PEDALS_HANDLER(op) op_##op: Op<op>(); PEDALS_DISPATCH()
+
+uint32_t SM83::Run(uint32_t cycles) {
+	static void* const handlers[256] = { PEDALS_OPCODES(PEDALS_HANDLER_LABEL) };
+
+	uint32_t elapsed = 0;
+	bool enable_interrupts = false;
+
+slow:
+	while (elapsed < cycles) {
+		if (m_State == State::Normal && !m_DoubleRead) {
+			m_LastOpCycles = 0;
+			enable_interrupts = m_EIqueued;
+			m_EIqueued = false;
+			goto *handlers[FetchOpcode()];
+		}
+
+		uint32_t step_cycles = Step(cycles - elapsed);
+		m_Bus->Tick(step_cycles);
+		elapsed += step_cycles;
+	}
+
+	return elapsed;
+
+	PEDALS_OPCODES(PEDALS_HANDLER)
+}
+
+#undef PEDALS_HANDLER
+#undef PEDALS_HANDLER_LABEL
+#undef PEDALS_DISPATCH
+#undef PEDALS_OPCODES
+#undef PEDALS_OPCODE_ROW
+
+#else
+
+uint32_t SM83::Run(uint32_t cycles) {
+	uint32_t elapsed = 0;
+
+	while (elapsed < cycles) {
+		uint32_t step_cycles = CanStepFast() ? StepFast() : Step(cycles - elapsed);
+		m_Bus->Tick(step_cycles);
+		elapsed += step_cycles;
+	}
+
+	return elapsed;
+}
+
+#endif
\ No newline at end of file
@@ -7,9 +7,16 @@
 
 #include "../peripherals/bus.hpp"
 #include "disassembler.hpp"
+#include "block_cache.hpp"
+#include "jit.hpp"
+#include "aot.hpp"
 
 #include <stdint.h>
 #include <memory>
+#include <array>
+#include <utility>
+#include <vector>
+#include <unordered_map>
 
 // this uses a nameless struct which is not standard and only works on little-endian host platforms
 #define RegisterPair(h, l) \
@@ -42,17 +49,28 @@ namespace pedals::cpu {
 	enum class State {
 		Normal,
 		Halt,
-		Stop
+		Stop,
+
+		// spinning in a loop that only polls memory, see SM83::CheckLoop
+		Idle,
+
+		// in a copy or fill loop whose remaining iterations can be done at once
+		Copy
 	};
 
 	class SM83 {
 	public:
-		SM83(std::shared_ptr<pedals::bus::Bus> bus) : m_Bus(bus) {}
+		SM83(pedals::bus::Bus& bus) : m_Bus(&bus) {}
 		void Reset();
 		void Dump(FILE* stream);
 
-		// returns the T-cycles the step took
-		uint8_t Step();
+		// returns the T-cycles the step took, while halted up to `budget` T-cycles are
+		// skipped at once if nothing can wake the CPU up before then
+		uint32_t Step(uint32_t budget = 4);
+
+		// steps until at least `cycles` T-cycles have passed, ticking the peripherals after every instruction
+		// returns the T-cycles that were actually run
+		uint32_t Run(uint32_t cycles);
 
 		bool InInterrupt() const {
 			return m_HandlingInterrupt;
@@ -71,7 +89,104 @@ namespace pedals::cpu {
 			return m_RETI;
 		}
 
+		// skipping ahead in polling loops and running copy loops in bulk, on by default
+		bool& GetAccelerateLoopsRef() {
+			return m_AccelerateLoops;
+		}
+
+#if defined(PEDALS_AOT)
+		// uses the blocks of the statically recompiled module if it was generated from this ROM
+		bool LoadPrecompiledBlocks(const std::vector<uint8_t>& rom);
+#endif
+
+#if defined(PEDALS_JIT) || defined(PEDALS_AOT)
+		// the handlers compiled blocks call for each instruction
+		static const std::array<JitHandler, 256>& GetCompiledHandlers() {
+			return s_JitTable;
+		}
+#endif
+
+		// has to be called when memory is changed behind the bus' back, e.g. by the debugger
+		void InvalidateBlockCache() {
+			m_BlockCache.Clear();
+			m_Block = nullptr;
+			m_Loop = {};
+			m_Fetch = {};
+
+#if defined(PEDALS_JIT)
+			m_JIT.Clear();
+#endif
+		}
+
+	public:
+		// the ALU operations whose flags only depend on their operands (and the old carry for Inc/Dec), the
+		// precompiled blocks use them too
+		enum class FlagOp : uint8_t {
+			Add,
+			Sub,
+			And,
+			Or,
+			Inc,
+			Dec,
+		};
+
+		// Add/Sub take the carry in, And/Or take the result in `a`, Inc/Dec take the old value and keep C from `f`
+		static constexpr uint8_t ComputeFlags(FlagOp op, uint8_t a, uint8_t b, uint8_t carry, uint8_t f) {
+			uint8_t flags = 0;
+
+			switch (op) {
+				case FlagOp::Add: {
+					uint16_t result = a + b + carry;
+					if ((result & 0xff) == 0) flags |= Flags::Zero;
+					if ((a & 0xf) + (b & 0xf) + carry > 0xf) flags |= Flags::HalfCarry;
+					if (result > 0xff) flags |= Flags::Carry;
+					break;
+				}
+
+				case FlagOp::Sub: {
+					int result = a - b - carry;
+					if ((result & 0xff) == 0) flags |= Flags::Zero;
+					flags |= Flags::Subtraction;
+					if ((a & 0xf) - (b & 0xf) - carry < 0) flags |= Flags::HalfCarry;
+					if (result < 0) flags |= Flags::Carry;
+					break;
+				}
+
+				case FlagOp::And: {
+					if (a == 0) flags |= Flags::Zero;
+					flags |= Flags::HalfCarry;
+					break;
+				}
+
+				case FlagOp::Or: {
+					if (a == 0) flags |= Flags::Zero;
+					break;
+				}
+
+				case FlagOp::Inc: {
+					if (static_cast<uint8_t>(a + 1) == 0) flags |= Flags::Zero;
+					if ((a & 0xf) == 0xf) flags |= Flags::HalfCarry;
+					flags |= f & Flags::Carry;
+					break;
+				}
+
+				case FlagOp::Dec: {
+					if (static_cast<uint8_t>(a - 1) == 0) flags |= Flags::Zero;
+					flags |= Flags::Subtraction;
+					if ((a & 0xf) == 0) flags |= Flags::HalfCarry;
+					flags |= f & Flags::Carry;
+					break;
+				}
+			}
+
+			return (f & 0x0f) | flags;
+		}
+
 	private:
+		inline void SetArithmeticFlags(FlagOp op, uint8_t a, uint8_t b = 0, uint8_t carry = 0) {
+			m_Registers.f = ComputeFlags(op, a, b, carry, m_Registers.f);
+		}
+
 		inline bool GetFlag(Flags flag) {
 			return (m_Registers.f & flag) != 0;
 		}
@@ -230,22 +345,163 @@ namespace pedals::cpu {
 			return (hi << 8) | lo;
 		}
 
+	private:
+		using OpHandler = void (*)(SM83&);
+
+		template <uint8_t index> uint8_t& Reg8();
+		template <uint8_t index> uint16_t& Reg16();
+
+		template <uint8_t opcode> void Op();
+		template <uint8_t opcode> void CBOp();
+
+		// the tables hold plain functions, a call through a member pointer has to check for virtuals first
+		template <uint8_t opcode> static void RunOp(SM83& cpu) { cpu.Op<opcode>(); }
+		template <uint8_t opcode> static void RunCBOp(SM83& cpu) { cpu.CBOp<opcode>(); }
+
+		template <size_t... opcodes>
+		static constexpr std::array<OpHandler, 256> MakeOpTable(std::index_sequence<opcodes...>);
+
+		template <size_t... opcodes>
+		static constexpr std::array<OpHandler, 256> MakeCBTable(std::index_sequence<opcodes...>);
+
+		// one specialized handler per opcode, generated in cpu.cpp
+		static const std::array<OpHandler, 256> s_OpTable;
+		static const std::array<OpHandler, 256> s_CBTable;
+
+#if defined(PEDALS_JIT) || defined(PEDALS_AOT)
+		CompiledBlock FindCompiledBlock(Block& block);
+
+		template <uint8_t opcode>
+		static bool JitOp(SM83* cpu, JitContext* context, const DecodedOp* op);
+
+		template <size_t... opcodes>
+		static constexpr std::array<JitHandler, 256> MakeJitTable(std::index_sequence<opcodes...>);
+
+		bool StartCompiledOp(JitContext* context, const DecodedOp* op);
+		bool FinishCompiledOp(JitContext* context, const DecodedOp* op, bool enable_interrupts);
+
+		void UpdateNativeBudget(JitContext* context);
+
+		// the handlers compiled blocks call into
+		static const std::array<JitHandler, 256> s_JitTable;
+#endif
+
+	private:
+		enum class LoopKind : uint8_t {
+			None,
+
+			// only reads memory that can not change before the next PPU or timer event, once an iteration
+			// has ended in the same state as the one before it the rest up to that event are skipped
+			Idle,
+
+			// ld (hl+/-), a / dec r
+			Fill,
+
+			// ld a, (hl+) / ld (de), a / inc de / dec r, or the same with (de) and (hl+) swapped
+			Copy,
+
+			// the same copy counting bc down with dec bc / ld a, b / or c
+			Copy16,
+		};
+
+		// the loop closed by the last backward jr that was taken
+		struct Loop {
+			uint16_t start = 0;
+			uint16_t end = 0;
+			uint32_t generation = 0;
+			bool in_ram = false;
+
+			LoopKind kind = LoopKind::None;
+
+			// T-cycles of one iteration including the taken jr
+			uint32_t cycles = 0;
+			bool reads_hl = false;
+
+			// LY and STAT move on without a scheduled event, so those reads are only stable while the PPU idles
+			bool reads_ppu = false;
+
+			// the dec of the 8-bit counter, the direction of hl and whether hl is the source of a copy
+			uint8_t dec_opcode = 0;
+			int8_t hl_step = 1;
+			bool hl_source = false;
+
+			// the state the last time the jr was taken, and the cycle up to which nothing it reads can change
+			uint64_t stamp = 0;
+			uint64_t quiet_until = 0;
+			uint64_t writes = 0;
+			Registers registers {};
+		};
+
+		void CheckLoop(uint16_t jr_address);
+		bool MatchCopyLoop(Loop& loop);
+		uint32_t ScanIdleLoop(uint16_t start, uint16_t end, bool& reads_hl, bool& reads_ppu);
+		uint32_t CyclesUntilLoopInputChanges();
+		uint32_t SkipIdleLoop(uint32_t budget);
+		uint32_t RunCopyLoop(uint32_t budget);
+
 	private:
 		void HandleInterrupts();
 		void CBStep();
 
+		// the common case of Step(), an instruction with no halt, EI or halt bug to take care of,
+		// returns the T-cycles it took without ticking the bus
+		bool CanStepFast() const {
+			return m_State == State::Normal && !m_DoubleRead && !m_EIqueued;
+		}
+
+		uint32_t StepFast();
+
+		// fetches the opcode at pc, from the decoded block when there is one
+		uint8_t FetchOpcode();
+		const DecodedOp* NextDecodedOp();
+
 		inline uint8_t Fetch8() {
+			if (m_DecodedOperands != nullptr) {
+				m_Registers.pc++;
+				return *m_DecodedOperands++;
+			}
+
+			if (CanFetchDirect(1)) {
+				return m_Fetch.data[m_Registers.pc++ - m_Fetch.start];
+			}
+
 			return m_Bus->ReadMemory(m_Registers.pc++);
 		}
 
 		inline uint16_t Fetch16() {
+			if (m_DecodedOperands != nullptr) {
+				m_Registers.pc += 2;
+				m_DecodedOperands += 2;
+				return (m_DecodedOperands[-1] << 8) | m_DecodedOperands[-2];
+			}
+
+			if (CanFetchDirect(2)) {
+				const uint8_t* data = m_Fetch.data + (m_Registers.pc - m_Fetch.start);
+				m_Registers.pc += 2;
+				return (data[1] << 8) | data[0];
+			}
+
 			m_Registers.pc += 2;
 			return m_Bus->ReadMemory16(m_Registers.pc - 2);
 		}
 
+		// true if the next count bytes at pc can be read straight out of m_Fetch, which is moved
+		// to the region pc is in when pc has left it or the MBC has switched banks
+		inline bool CanFetchDirect(uint32_t count) {
+			uint32_t pc = m_Registers.pc;
+			if (pc < m_Fetch.start || pc + count > m_Fetch.end || m_FetchGeneration != m_Bus->GetMappingGeneration()) {
+				UpdateFetchRegion();
+				if (pc + count > m_Fetch.end) return false;
+			}
+
+			return m_Fetch.data != nullptr;
+		}
+
+		void UpdateFetchRegion();
+
 	private:
 		Registers m_Registers;
-		std::shared_ptr<pedals::bus::Bus> m_Bus;
+		pedals::bus::Bus* m_Bus;
 		uint8_t m_LastOpCycles = 0;
 		bool m_IME = false;
 		bool m_EIqueued = false;
@@ -256,6 +512,29 @@ namespace pedals::cpu {
 		
 		bool m_HandlingInterrupt = false;
 		bool m_RETI = false;
+
+		bool m_AccelerateLoops = true;
+		Loop m_Loop;
+
+		BlockCache m_BlockCache;
+		Block* m_Block = nullptr;
+		size_t m_BlockIndex = 0;
+		uint32_t m_BlockGeneration = 0;
+
+		// operand bytes of the instruction being executed if it came from a decoded block
+		const uint8_t* m_DecodedOperands = nullptr;
+
+		// the memory pc is in, for fetching outside of decoded blocks without going through the bus
+		pedals::bus::Bus::FetchRegion m_Fetch;
+		uint32_t m_FetchGeneration = 0;
+
+#if defined(PEDALS_JIT)
+		JIT m_JIT;
+#endif
+
+#if defined(PEDALS_AOT)
+		std::unordered_map<uint32_t, CompiledBlock> m_Precompiled;
+#endif
 	};
 }
 
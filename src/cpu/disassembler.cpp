@@ -1,8 +1,8 @@
 #include <format>
 #include "disassembler.hpp"
 
-static std::string disassemble_cb(std::shared_ptr<pedals::bus::Bus> bus, uint16_t pc) {
-	switch (bus->ReadMemory(pc)) {
+static std::string disassemble_cb(pedals::bus::Bus& bus, uint16_t pc) {
+	switch (bus.ReadMemory(pc)) {
 		case 0x00: return "RLC B";
 		case 0x01: return "RLC C";
 		case 0x02: return "RLC D";
@@ -288,12 +288,12 @@ const char* op_table[] = {
 	"-", 		"", 			"RST $38"
 };
 
-std::string pedals::cpu::DisassembleInstruction(std::shared_ptr<pedals::bus::Bus> bus, uint16_t pc) {
-	uint16_t n16 = bus->ReadMemory16(pc + 1);
-	uint8_t n8 = bus->ReadMemory(pc + 1);
+std::string pedals::cpu::DisassembleInstruction(pedals::bus::Bus& bus, uint16_t pc) {
+	uint16_t n16 = bus.ReadMemory16(pc + 1);
+	uint8_t n8 = bus.ReadMemory(pc + 1);
 	int8_t e8 = static_cast<int8_t>(n8);
 
-	uint8_t opcode = bus->ReadMemory(pc);
+	uint8_t opcode = bus.ReadMemory(pc);
 	switch (opcode) {
 		case 0x01: return std::format("LD BC, ${:04x}", n16);
 		case 0x06: return std::format("LD B, ${:02x}", n8);
@@ -0,0 +1,634 @@
+#if defined(PEDALS_JIT)
+
+#include "jit.hpp"
+#include "cpu.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <print>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace pedals::cpu;
+
+static constexpr size_t code_buffer_size = 16 * 1024 * 1024;
+
+// worst case size of one compiled instruction (native, its handler call for the slow path and the
+// check in front of a native run) and of the prologue plus epilogue
+static constexpr size_t max_op_size = 192;
+static constexpr size_t max_frame_size = 64;
+
+// a run of native instructions, `patch` jumps to its handlers which continue at `resume`
+struct SlowRun {
+	size_t patch;
+	size_t resume;
+	size_t first;
+	size_t end;
+};
+
+// x86-64 register numbers, rbx holds the cpu, rbp the context and r12 the flag table
+enum : uint8_t {
+	rax = 0,
+	rcx = 1,
+	rdx = 2,
+	rbx = 3,
+	rbp = 5,
+};
+
+// maps the x86 flags lahf puts into ah to Z, H and C
+static constexpr std::array<uint8_t, 256> flag_table = [] {
+	std::array<uint8_t, 256> table {};
+
+	for (size_t ah = 0; ah < 256; ah++) {
+		if (ah & 0x40) table[ah] |= Flags::Zero;
+		if (ah & 0x10) table[ah] |= Flags::HalfCarry;
+		if (ah & 0x01) table[ah] |= Flags::Carry;
+	}
+
+	return table;
+}();
+
+// register offsets inside Registers, by the 3 bit operand index of the opcode ((HL) is 6)
+static constexpr int32_t reg8_offsets[8] = {
+	offsetof(Registers, b), offsetof(Registers, c), offsetof(Registers, d), offsetof(Registers, e),
+	offsetof(Registers, h), offsetof(Registers, l), -1, offsetof(Registers, a),
+};
+
+static constexpr int32_t reg16_offsets[4] = {
+	offsetof(Registers, bc), offsetof(Registers, de), offsetof(Registers, hl), offsetof(Registers, sp),
+};
+
+static constexpr int32_t a_offset = offsetof(Registers, a);
+static constexpr int32_t f_offset = offsetof(Registers, f);
+static constexpr int32_t hl_offset = offsetof(Registers, hl);
+static constexpr int32_t sp_offset = offsetof(Registers, sp);
+static constexpr int32_t pc_offset = offsetof(Registers, pc);
+
+JIT::JIT() {
+	void* code = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		std::println("jit: failed to allocate the code buffer, falling back to the interpreter");
+		m_Disabled = true;
+		return;
+	}
+
+	m_Code = static_cast<uint8_t*>(code);
+	m_Size = code_buffer_size;
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size > 0) {
+		m_PageSize = static_cast<size_t>(page_size);
+	}
+}
+
+JIT::~JIT() {
+	if (m_Code != nullptr) {
+		munmap(m_Code, m_Size);
+	}
+}
+
+void JIT::Clear() {
+	m_Used = 0;
+	m_Full = false;
+}
+
+CompiledBlock JIT::GetOrCompile(Block& block, const JitTarget& target) {
+	if (block.native != nullptr) {
+		return reinterpret_cast<CompiledBlock>(block.native);
+	}
+
+	// code in RAM can be rewritten at any time so it is left to the interpreter
+	if (block.in_ram || m_Full || m_Disabled || ++block.hits < HotThreshold) {
+		return nullptr;
+	}
+
+	CompiledBlock compiled = Compile(block, target);
+	block.native = reinterpret_cast<void*>(compiled);
+	return compiled;
+}
+
+bool JIT::Protect(size_t start, size_t end, int protection) {
+	size_t first = start & ~(m_PageSize - 1);
+	size_t last = std::min((end + m_PageSize - 1) & ~(m_PageSize - 1), m_Size);
+
+	return mprotect(m_Code + first, last - first, protection) == 0;
+}
+
+void JIT::Emit8(uint8_t value) {
+	m_Code[m_Used++] = value;
+}
+
+void JIT::Emit16(uint16_t value) {
+	std::memcpy(m_Code + m_Used, &value, sizeof(value));
+	m_Used += sizeof(value);
+}
+
+void JIT::Emit32(uint32_t value) {
+	std::memcpy(m_Code + m_Used, &value, sizeof(value));
+	m_Used += sizeof(value);
+}
+
+void JIT::Emit64(uint64_t value) {
+	std::memcpy(m_Code + m_Used, &value, sizeof(value));
+	m_Used += sizeof(value);
+}
+
+void JIT::Emit(std::initializer_list<uint8_t> bytes) {
+	for (uint8_t byte : bytes) {
+		Emit8(byte);
+	}
+}
+
+void JIT::EmitCPU(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t offset) {
+	Emit(opcode);
+	Emit8(0x80 | (reg << 3) | rbx);
+	Emit32(static_cast<uint32_t>(m_Target->registers + offset));
+}
+
+void JIT::EmitContext(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t offset) {
+	Emit(opcode);
+	Emit8(0x80 | (reg << 3) | rbp);
+	Emit32(static_cast<uint32_t>(offset));
+}
+
+size_t JIT::EmitJump(std::initializer_list<uint8_t> opcode) {
+	Emit(opcode);
+	size_t patch = m_Used;
+	Emit32(0);
+	return patch;
+}
+
+void JIT::PatchJump(size_t patch, size_t target) {
+	int32_t rel = static_cast<int32_t>(target - (patch + 4));
+	std::memcpy(m_Code + patch, &rel, sizeof(rel));
+}
+
+void JIT::EmitHandler(const Block& block, size_t index, std::vector<size_t>& exits) {
+	const DecodedOp& op = block.ops[index];
+
+	// mov rdi, rbx; mov rsi, rbp; mov rdx, &op
+	Emit({ 0x48, 0x89, 0xdf, 0x48, 0x89, 0xee, 0x48, 0xba });
+	Emit64(reinterpret_cast<uint64_t>(&op));
+
+	// mov rax, handler; call rax
+	Emit({ 0x48, 0xb8 });
+	Emit64(reinterpret_cast<uint64_t>((*m_Target->handlers)[op.opcode]));
+	Emit({ 0xff, 0xd0 });
+
+	// the last instruction always leaves the block so it needs no check
+	if (index + 1 < block.ops.size()) {
+		// test al, al; jnz exit
+		Emit({ 0x84, 0xc0 });
+		exits.push_back(EmitJump({ 0x0f, 0x85 }));
+	}
+}
+
+void JIT::EmitFlags(uint8_t from, uint8_t set, uint8_t keep) {
+	// movzx ecx, ah; movzx ecx, byte [r12 + rcx]
+	Emit({ 0x0f, 0xb6, 0xcc, 0x41, 0x0f, 0xb6, 0x0c, 0x0c });
+
+	// and cl, from
+	if (from != (Flags::Zero | Flags::HalfCarry | Flags::Carry)) Emit({ 0x80, 0xe1, from });
+
+	// or cl, set
+	if (set != 0) Emit({ 0x80, 0xc9, set });
+
+	if (keep != 0) {
+		// mov dl, [f]; and dl, keep; or cl, dl
+		EmitCPU({ 0x8a }, rdx, f_offset);
+		Emit({ 0x80, 0xe2, keep, 0x08, 0xd1 });
+	}
+
+	// mov [f], cl
+	EmitCPU({ 0x88 }, rcx, f_offset);
+}
+
+void JIT::EmitZeroFlag(bool carry, uint8_t set, uint8_t keep) {
+	// setc dl; shl dl, 4
+	if (carry) Emit({ 0x0f, 0x92, 0xc2, 0xc0, 0xe2, 0x04 });
+
+	// test al, al; setz cl; shl cl, 7
+	Emit({ 0x84, 0xc0, 0x0f, 0x94, 0xc1, 0xc0, 0xe1, 0x07 });
+
+	// or cl, dl
+	if (carry) Emit({ 0x08, 0xd1 });
+
+	// or cl, set
+	if (set != 0) Emit({ 0x80, 0xc9, set });
+
+	if (keep != 0) {
+		// mov dl, [f]; and dl, keep; or cl, dl
+		EmitCPU({ 0x8a }, rdx, f_offset);
+		Emit({ 0x80, 0xe2, keep, 0x08, 0xd1 });
+	}
+
+	// mov [f], cl
+	EmitCPU({ 0x88 }, rcx, f_offset);
+}
+
+// A = A <operation> dl, operation is the y of the opcode (ADD, ADC, SUB, SBC, AND, XOR, OR, CP)
+void JIT::EmitALU(uint8_t operation) {
+	// mov al, [a]
+	EmitCPU({ 0x8a }, rax, a_offset);
+
+	// mov cl, [f]; shr cl, 5 puts the carry into CF
+	if (operation == 1 || operation == 3) {
+		EmitCPU({ 0x8a }, rcx, f_offset);
+		Emit({ 0xc0, 0xe9, 0x05 });
+	}
+
+	// add, adc, sub, sbb, and, xor, or, cmp al, dl
+	static constexpr uint8_t x86_operations[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+	Emit({ x86_operations[operation], 0xd0 });
+
+	if (operation < 4 || operation == 7) {
+		// lahf
+		Emit8(0x9f);
+		EmitFlags(Flags::Zero | Flags::HalfCarry | Flags::Carry, (operation >= 2) ? Flags::Subtraction : 0, 0);
+	} else {
+		EmitZeroFlag(false, (operation == 4) ? Flags::HalfCarry : 0, 0);
+	}
+
+	// mov [a], al
+	if (operation != 7) EmitCPU({ 0x88 }, rax, a_offset);
+}
+
+void JIT::EmitCB(uint8_t cb_opcode) {
+	uint8_t y = (cb_opcode >> 3) & 7;
+	int32_t offset = reg8_offsets[cb_opcode & 7];
+	uint8_t mask = 1 << y;
+
+	// BIT: test byte [r], mask
+	if (cb_opcode >= 0x40 && cb_opcode < 0x80) {
+		EmitCPU({ 0xf6 }, 0, offset);
+		Emit8(mask);
+
+		// setz cl; shl cl, 7; or cl, H; keep C
+		Emit({ 0x0f, 0x94, 0xc1, 0xc0, 0xe1, 0x07, 0x80, 0xc9, Flags::HalfCarry });
+		EmitCPU({ 0x8a }, rdx, f_offset);
+		Emit({ 0x80, 0xe2, Flags::Carry, 0x08, 0xd1 });
+		EmitCPU({ 0x88 }, rcx, f_offset);
+		return;
+	}
+
+	// RES: and byte [r], ~mask
+	if (cb_opcode >= 0x80 && cb_opcode < 0xc0) {
+		EmitCPU({ 0x80 }, 4, offset);
+		Emit8(static_cast<uint8_t>(~mask));
+		return;
+	}
+
+	// SET: or byte [r], mask
+	if (cb_opcode >= 0xc0) {
+		EmitCPU({ 0x80 }, 1, offset);
+		Emit8(mask);
+		return;
+	}
+
+	// RL and RR shift the carry in
+	if (y == 2 || y == 3) {
+		EmitCPU({ 0x8a }, rcx, f_offset);
+		Emit({ 0xc0, 0xe9, 0x05 });
+	}
+
+	// mov al, [r]
+	EmitCPU({ 0x8a }, rax, offset);
+
+	switch (y) {
+		case 0: Emit({ 0xd0, 0xc0 }); break; // rol al, 1
+		case 1: Emit({ 0xd0, 0xc8 }); break; // ror al, 1
+		case 2: Emit({ 0xd0, 0xd0 }); break; // rcl al, 1
+		case 3: Emit({ 0xd0, 0xd8 }); break; // rcr al, 1
+		case 4: Emit({ 0xd0, 0xe0 }); break; // shl al, 1
+		case 5: Emit({ 0xd0, 0xf8 }); break; // sar al, 1
+		case 6: Emit({ 0xc0, 0xc0, 0x04 }); break; // rol al, 4
+		default: Emit({ 0xd0, 0xe8 }); break; // shr al, 1
+	}
+
+	// SWAP clears the carry
+	EmitZeroFlag(y != 6, 0, 0);
+
+	// mov [r], al
+	EmitCPU({ 0x88 }, rax, offset);
+}
+
+// pc is set to where the branch goes, a taken conditional branch takes 4 T-cycles more
+void JIT::EmitBranch(const DecodedOp& op, uint16_t target) {
+	if (!BlockCache::IsConditionalBranch(op.opcode)) {
+		// mov word [pc], target
+		EmitCPU({ 0x66, 0xc7 }, 0, pc_offset);
+		Emit16(target);
+		return;
+	}
+
+	uint8_t y = (op.opcode >> 3) & 7;
+	uint8_t flag = (y & 0b10) ? Flags::Carry : Flags::Zero;
+
+	// mov word [pc], next; test byte [f], flag
+	EmitCPU({ 0x66, 0xc7 }, 0, pc_offset);
+	Emit16(static_cast<uint16_t>(op.address + op.length));
+	EmitCPU({ 0xf6 }, 0, f_offset);
+	Emit8(flag);
+
+	// NZ and NC are taken when the flag is clear, so they skip over the jump when it is set
+	size_t skip = EmitJump({ 0x0f, static_cast<uint8_t>((y & 1) ? 0x84 : 0x85) });
+
+	EmitCPU({ 0x66, 0xc7 }, 0, pc_offset);
+	Emit16(target);
+
+	// add dword [elapsed], 4; add dword [pending], 4
+	EmitContext({ 0x81 }, 0, offsetof(JitContext, elapsed));
+	Emit32(4);
+	EmitContext({ 0x81 }, 0, offsetof(JitContext, pending));
+	Emit32(4);
+
+	PatchJump(skip, m_Used);
+}
+
+void JIT::EmitNative(const DecodedOp& op) {
+	uint8_t x = op.opcode >> 6;
+	uint8_t y = (op.opcode >> 3) & 7;
+	uint8_t z = op.opcode & 7;
+	uint8_t p = y >> 1;
+	uint16_t operand16 = static_cast<uint16_t>(op.operands[0] | (op.operands[1] << 8));
+
+	if (op.opcode == 0x00) return;
+
+	// JR
+	if (op.opcode == 0x18 || (x == 0 && BlockCache::IsConditionalBranch(op.opcode))) {
+		uint16_t target = static_cast<uint16_t>(op.address + op.length + static_cast<int8_t>(op.operands[0]));
+		EmitBranch(op, target);
+		return;
+	}
+
+	if (x == 0) {
+		switch (z) {
+			// LD rr, nn: mov word [rr], nn
+			case 1: {
+				if ((y & 1) == 0) {
+					EmitCPU({ 0x66, 0xc7 }, 0, reg16_offsets[p]);
+					Emit16(operand16);
+					return;
+				}
+
+				// ADD HL, rr: movzx eax, word [hl]; movzx edx, word [rr]
+				EmitCPU({ 0x0f, 0xb7 }, rax, hl_offset);
+				EmitCPU({ 0x0f, 0xb7 }, rdx, reg16_offsets[p]);
+
+				// H from the low 12 bits: mov ecx, eax; and ecx, 0xfff; mov esi, edx; and esi, 0xfff;
+				// add ecx, esi; shr ecx, 12; shl ecx, 5
+				Emit({ 0x89, 0xc1, 0x81, 0xe1, 0xff, 0x0f, 0x00, 0x00, 0x89, 0xd6, 0x81, 0xe6, 0xff, 0x0f, 0x00, 0x00 });
+				Emit({ 0x01, 0xf1, 0xc1, 0xe9, 0x0c, 0xc1, 0xe1, 0x05 });
+
+				// add eax, edx; mov [hl], ax; shr eax, 16; shl eax, 4; or ecx, eax
+				Emit({ 0x01, 0xd0 });
+				EmitCPU({ 0x66, 0x89 }, rax, hl_offset);
+				Emit({ 0xc1, 0xe8, 0x10, 0xc1, 0xe0, 0x04, 0x09, 0xc1 });
+
+				// keep Z
+				EmitCPU({ 0x8a }, rdx, f_offset);
+				Emit({ 0x80, 0xe2, Flags::Zero, 0x08, 0xd1 });
+				EmitCPU({ 0x88 }, rcx, f_offset);
+				return;
+			}
+
+			// INC rr / DEC rr: inc/dec word [rr]
+			case 3: {
+				EmitCPU({ 0x66, 0xff }, (y & 1) ? 1 : 0, reg16_offsets[p]);
+				return;
+			}
+
+			// INC r / DEC r: mov al, [r]; inc/dec al; lahf, C stays
+			case 4:
+			case 5: {
+				EmitCPU({ 0x8a }, rax, reg8_offsets[y]);
+				Emit({ 0xfe, static_cast<uint8_t>((z == 4) ? 0xc0 : 0xc8), 0x9f });
+				EmitCPU({ 0x88 }, rax, reg8_offsets[y]);
+				EmitFlags(Flags::Zero | Flags::HalfCarry, (z == 5) ? Flags::Subtraction : 0, Flags::Carry);
+				return;
+			}
+
+			// LD r, n: mov byte [r], n
+			case 6: {
+				EmitCPU({ 0xc6 }, 0, reg8_offsets[y]);
+				Emit8(op.operands[0]);
+				return;
+			}
+
+			default: break;
+		}
+
+		switch (y) {
+			// RLCA, RRCA, RLA, RRA clear Z, N and H
+			case 0:
+			case 1:
+			case 2:
+			case 3: {
+				if (y >= 2) {
+					EmitCPU({ 0x8a }, rcx, f_offset);
+					Emit({ 0xc0, 0xe9, 0x05 });
+				}
+
+				static constexpr uint8_t rotates[4] = { 0xc0, 0xc8, 0xd0, 0xd8 };
+				EmitCPU({ 0x8a }, rax, a_offset);
+				Emit({ 0xd0, rotates[y] });
+
+				// setc cl; shl cl, 4
+				Emit({ 0x0f, 0x92, 0xc1, 0xc0, 0xe1, 0x04 });
+				EmitCPU({ 0x88 }, rax, a_offset);
+				EmitCPU({ 0x88 }, rcx, f_offset);
+				return;
+			}
+
+			// CPL: not byte [a]; or byte [f], N | H
+			case 5: {
+				EmitCPU({ 0xf6 }, 2, a_offset);
+				EmitCPU({ 0x80 }, 1, f_offset);
+				Emit8(Flags::Subtraction | Flags::HalfCarry);
+				return;
+			}
+
+			// SCF: and byte [f], Z; or byte [f], C
+			case 6: {
+				EmitCPU({ 0x80 }, 4, f_offset);
+				Emit8(Flags::Zero);
+				EmitCPU({ 0x80 }, 1, f_offset);
+				Emit8(Flags::Carry);
+				return;
+			}
+
+			// CCF: and byte [f], Z | C; xor byte [f], C
+			default: {
+				EmitCPU({ 0x80 }, 4, f_offset);
+				Emit8(Flags::Zero | Flags::Carry);
+				EmitCPU({ 0x80 }, 6, f_offset);
+				Emit8(Flags::Carry);
+				return;
+			}
+		}
+	}
+
+	// LD r, r': movzx eax, byte [r']; mov [r], al
+	if (x == 1) {
+		EmitCPU({ 0x0f, 0xb6 }, rax, reg8_offsets[z]);
+		EmitCPU({ 0x88 }, rax, reg8_offsets[y]);
+		return;
+	}
+
+	// ALU A, r: mov dl, [r]
+	if (x == 2) {
+		EmitCPU({ 0x8a }, rdx, reg8_offsets[z]);
+		EmitALU(y);
+		return;
+	}
+
+	// ALU A, n: mov dl, n
+	if (z == 6) {
+		Emit({ 0xb2, op.operands[0] });
+		EmitALU(y);
+		return;
+	}
+
+	if (op.opcode == 0xcb) {
+		EmitCB(op.operands[0]);
+		return;
+	}
+
+	// JP (HL) / LD SP, HL: movzx eax, word [hl]; mov [pc or sp], ax
+	if (op.opcode == 0xe9 || op.opcode == 0xf9) {
+		EmitCPU({ 0x0f, 0xb7 }, rax, hl_offset);
+		EmitCPU({ 0x66, 0x89 }, rax, (op.opcode == 0xe9) ? pc_offset : sp_offset);
+		return;
+	}
+
+	// JP nn / JP cc, nn
+	EmitBranch(op, operand16);
+}
+
+CompiledBlock JIT::Compile(const Block& block, const JitTarget& target) {
+	size_t worst_case = max_frame_size + block.ops.size() * max_op_size;
+	if (m_Used + worst_case > m_Size) {
+		m_Full = true;
+		return nullptr;
+	}
+
+	// everything compiled before keeps running while the new code is written after it
+	if (!Protect(m_Used, m_Used + worst_case, PROT_READ | PROT_WRITE)) {
+		std::println("jit: failed to make the code buffer writable, falling back to the interpreter");
+		m_Disabled = true;
+		m_Full = true;
+		return nullptr;
+	}
+
+	m_Target = &target;
+	size_t entry = m_Used;
+
+	// jumps to the epilogue, and the native runs that have to go through the handlers instead
+	std::vector<size_t> exits;
+	std::vector<SlowRun> slow_runs;
+
+	// push rbx; push rbp; push r12 (keeps the stack 16 byte aligned for the calls)
+	Emit({ 0x53, 0x55, 0x41, 0x54 });
+
+	// mov rbx, rdi (cpu); mov rbp, rsi (context); mov r12, flag table
+	Emit({ 0x48, 0x89, 0xfb, 0x48, 0x89, 0xf5, 0x49, 0xbc });
+	Emit64(reinterpret_cast<uint64_t>(flag_table.data()));
+
+	// native instructions leave pc behind, it is only stored when something else needs it
+	bool pc_current = true;
+
+	size_t i = 0;
+	while (i < block.ops.size()) {
+		const DecodedOp& op = block.ops[i];
+
+		if (!BlockCache::IsNative(op)) {
+			if (!pc_current) {
+				EmitCPU({ 0x66, 0xc7 }, 0, pc_offset);
+				Emit16(op.address);
+				pc_current = true;
+			}
+
+			EmitHandler(block, i, exits);
+			i++;
+			continue;
+		}
+
+		// nothing can happen in the middle of a run of native instructions if all of it fits before
+		// the next event, otherwise the same instructions go through their handlers out of line
+		size_t end = i;
+		uint32_t cycles = 0;
+		uint32_t max_cycles = 0;
+
+		while (end < block.ops.size() && BlockCache::IsNative(block.ops[end])) {
+			cycles += block.ops[end].cycles;
+			max_cycles += block.ops[end].cycles + (BlockCache::IsConditionalBranch(block.ops[end].opcode) ? 4 : 0);
+			end++;
+		}
+
+		// cmp dword [budget], max_cycles; jb slow
+		EmitContext({ 0x81 }, 7, offsetof(JitContext, budget));
+		Emit32(max_cycles);
+		size_t slow = EmitJump({ 0x0f, 0x82 });
+
+		size_t first = i;
+		for (; i < end; i++) {
+			EmitNative(block.ops[i]);
+		}
+
+		// add dword [elapsed], cycles; add dword [pending], cycles
+		EmitContext({ 0x81 }, 0, offsetof(JitContext, elapsed));
+		Emit32(cycles);
+		EmitContext({ 0x81 }, 0, offsetof(JitContext, pending));
+		Emit32(cycles);
+
+		slow_runs.push_back({ slow, m_Used, first, end });
+
+		// pc is only current here if the run ended with a jump, which is also the end of the block
+		pc_current = BlockCache::IsBranch(block.ops[end - 1].opcode);
+	}
+
+	// the block was cut off without a jump
+	if (!pc_current) {
+		const DecodedOp& last = block.ops.back();
+		EmitCPU({ 0x66, 0xc7 }, 0, pc_offset);
+		Emit16(static_cast<uint16_t>(last.address + last.length));
+	}
+
+	size_t exit = m_Used;
+
+	// pop r12; pop rbp; pop rbx; ret
+	Emit({ 0x41, 0x5c, 0x5d, 0x5b, 0xc3 });
+
+	// the handlers of a run, pc is current when they start because runs only follow handlers
+	for (const SlowRun& run : slow_runs) {
+		PatchJump(run.patch, m_Used);
+
+		for (size_t op = run.first; op < run.end; op++) {
+			EmitHandler(block, op, exits);
+		}
+
+		// the handlers keep pc current, a run that ends the block must not go back to the pc store after it
+		size_t resume = EmitJump({ 0xe9 });
+		if (run.end == block.ops.size()) {
+			exits.push_back(resume);
+		} else {
+			PatchJump(resume, run.resume);
+		}
+	}
+
+	for (size_t patch : exits) {
+		PatchJump(patch, exit);
+	}
+
+	if (!Protect(entry, m_Used, PROT_READ | PROT_EXEC)) {
+		std::println("jit: failed to make the code buffer executable, falling back to the interpreter");
+		m_Disabled = true;
+		m_Full = true;
+		return nullptr;
+	}
+
+	return reinterpret_cast<CompiledBlock>(m_Code + entry);
+}
+
+#endif
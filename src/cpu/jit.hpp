@@ -0,0 +1,122 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "block_cache.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <initializer_list>
+#include <vector>
+
+namespace pedals::cpu {
+	class SM83;
+
+	// state shared between SM83::Run and the compiled blocks
+	struct JitContext {
+		uint32_t elapsed;
+		uint32_t cycles;
+		uint32_t generation;
+
+		// T-cycles native instructions can run before an event is due or the budget runs out,
+		// set before a block is entered and after every handler
+		uint32_t budget;
+
+		// T-cycles of native instructions the bus has not been ticked for yet
+		uint32_t pending;
+	};
+
+	// runs one instruction of a compiled block and finishes it like Step() does,
+	// returns true if the block has to be left before its next instruction
+	using JitHandler = bool (*)(SM83*, JitContext*, const DecodedOp*);
+
+	// native code for a block, either from the JIT or from the static recompiler
+	using CompiledBlock = void (*)(SM83*, JitContext*);
+
+	// what the compiled code needs to know about the CPU it runs on
+	struct JitTarget {
+		const std::array<JitHandler, 256>* handlers;
+
+		// offset of the Registers from the SM83 pointer
+		int32_t registers;
+	};
+}
+
+#if defined(PEDALS_JIT)
+
+namespace pedals::cpu {
+	// translates ROM blocks into x86-64 code. register loads, ALU operations and jumps are done
+	// natively on the register file, everything touching memory or the interrupt state calls its
+	// handler. a run of native instructions only checks once that no event is due before its end
+	class JIT {
+	public:
+		// blocks have to be entered this many times before they get compiled
+		static constexpr uint32_t HotThreshold = 32;
+
+		JIT();
+		~JIT();
+
+		JIT(const JIT&) = delete;
+		JIT& operator=(const JIT&) = delete;
+
+		// returns nullptr while the block is still cold or if it can not be compiled
+		CompiledBlock GetOrCompile(Block& block, const JitTarget& target);
+
+		// throws away all compiled code, the blocks pointing into it have to be cleared as well
+		void Clear();
+
+		bool IsFull() const {
+			return m_Full;
+		}
+
+	private:
+		CompiledBlock Compile(const Block& block, const JitTarget& target);
+
+		// only the pages between the two offsets change protection
+		bool Protect(size_t start, size_t end, int protection);
+
+		void EmitNative(const DecodedOp& op);
+		void EmitALU(uint8_t operation);
+		void EmitCB(uint8_t cb_opcode);
+		void EmitBranch(const DecodedOp& op, uint16_t target);
+
+		// F from the x86 flags lahf left in ah, only the `from` flags are taken over
+		void EmitFlags(uint8_t from, uint8_t set, uint8_t keep);
+
+		// F from the result in al, with the carry in CF if `carry` is set
+		void EmitZeroFlag(bool carry, uint8_t set, uint8_t keep);
+
+		void EmitHandler(const Block& block, size_t index, std::vector<size_t>& exits);
+		size_t EmitJump(std::initializer_list<uint8_t> opcode);
+		void PatchJump(size_t patch, size_t target);
+
+		// <opcode> reg, [cpu + offset] and [context + offset]
+		void EmitCPU(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t offset);
+		void EmitContext(std::initializer_list<uint8_t> opcode, uint8_t reg, int32_t offset);
+
+		void Emit8(uint8_t value);
+		void Emit16(uint16_t value);
+		void Emit32(uint32_t value);
+		void Emit64(uint64_t value);
+		void Emit(std::initializer_list<uint8_t> bytes);
+
+	private:
+		uint8_t* m_Code = nullptr;
+		size_t m_Size = 0;
+		size_t m_Used = 0;
+		size_t m_PageSize = 4096;
+
+		// the target of the block being compiled
+		const JitTarget* m_Target = nullptr;
+
+		// set when the code buffer ran out, nothing else gets compiled until the next Clear()
+		bool m_Full = false;
+
+		// set if the code buffer could not be allocated or made executable
+		bool m_Disabled = false;
+	};
+}
+
+#endif
+
+#endif
@@ -10,11 +10,10 @@ void DebugUI::CPU_DrawControlButtons() {
 
     ImGui::SameLine();
     if (ImGui::Button("Step")) {
-        uint8_t step_cycles = m_CPU->Step();
-        for (size_t i = 0; i < step_cycles; i++) {
-            m_PPU->Tick();
-            m_Timer->Tick();
-        }
+        m_Bus->Tick(m_CPU->Step());
+
+        // the PPU only catches up when it has to, bring it along so the LCD follows each step
+        m_PPU->Sync();
     }
 
     ImGui::SameLine();
@@ -22,6 +21,9 @@ void DebugUI::CPU_DrawControlButtons() {
         m_CPU->Reset();
         m_Bus->SetBootROMVisibility(true);
     }
+
+    ImGui::SameLine();
+    ImGui::Checkbox("Accelerate Loops", &m_CPU->GetAccelerateLoopsRef());
 }
 
 void DebugUI::CPU_DrawStackControls() {
@@ -77,7 +79,7 @@ void DebugUI::CPU_DrawInterrupts() {
 
 void DebugUI::CPU_DrawDisassembly() {
 	uint16_t pc = m_CPU->GetRegistersRef().pc;
-    std::string disasm = pedals::cpu::DisassembleInstruction(m_Bus, pc);
+    std::string disasm = pedals::cpu::DisassembleInstruction(*m_Bus, pc);
     ImGui::Text("%04x: %s", pc, disasm.c_str());
 }
 
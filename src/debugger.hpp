@@ -1,12 +1,7 @@
 #ifndef DEBUGGER_HPP
 #define DEBUGGER_HPP
 
-#include "cpu/cpu.hpp"
-#include "peripherals/bus.hpp"
-#include "cartridge/cartridge.hpp"
-#include "peripherals/joypad.hpp"
-#include "peripherals/timer.hpp"
-#include "ppu/ppu.hpp"
+#include "gameboy.hpp"
 
 #include "thirdparty/imgui.h"
 #include "thirdparty/imgui_memory_editor.h"
@@ -16,10 +11,17 @@
 namespace pedals::debugger {
 	class DebugUI {
 	public:
-		DebugUI(std::shared_ptr<pedals::cpu::SM83> cpu, std::shared_ptr<pedals::bus::Bus> bus, std::shared_ptr<pedals::timer::Timer> timer, std::shared_ptr<pedals::ppu::PPU> ppu, std::shared_ptr<pedals::cartridge::Cartridge> cartridge, uint32_t* palette)
-			: m_CPU(cpu), m_Bus(bus), m_Timer(timer), m_PPU(ppu), m_Cartridge(cartridge), m_Palette(palette) {
+		DebugUI(pedals::gameboy::GameBoy& gameboy, uint32_t* palette)
+			: m_CPU(&gameboy.GetCPU()), m_Bus(&gameboy.GetBus()), m_Timer(&gameboy.GetTimer()), m_PPU(&gameboy.GetPPU()), m_Cartridge(&gameboy.GetCartridge()), m_Palette(palette) {
 				m_MemoryEditor.OptShowAscii = false;
 				m_MemoryEditor.OptUpperCaseHex = false;
+
+				// edited bytes could be code the CPU has already decoded
+				m_MemoryEditor.UserData = m_CPU;
+				m_MemoryEditor.WriteFn = [](ImU8* mem, size_t offset, ImU8 value, void* cpu) {
+					mem[offset] = value;
+					static_cast<pedals::cpu::SM83*>(cpu)->InvalidateBlockCache();
+				};
 			}
 
 		void Draw() {
@@ -73,11 +75,11 @@ namespace pedals::debugger {
 		void PPU_DrawOAM();
 
 	private:
-		std::shared_ptr<pedals::cpu::SM83> m_CPU;
-		std::shared_ptr<pedals::bus::Bus> m_Bus;
-		std::shared_ptr<pedals::timer::Timer> m_Timer;
-		std::shared_ptr<pedals::ppu::PPU> m_PPU;
-		std::shared_ptr<pedals::cartridge::Cartridge> m_Cartridge;
+		pedals::cpu::SM83* m_CPU;
+		pedals::bus::Bus* m_Bus;
+		pedals::timer::Timer* m_Timer;
+		pedals::ppu::PPU* m_PPU;
+		pedals::cartridge::Cartridge* m_Cartridge;
 
 		bool m_SingleStep = false;
 		bool m_BreakOnInterrupt = false;
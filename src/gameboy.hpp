@@ -0,0 +1,66 @@
+#ifndef GAMEBOY_HPP
+#define GAMEBOY_HPP
+
+#include "cpu/cpu.hpp"
+#include "peripherals/bus.hpp"
+#include "cartridge/cartridge.hpp"
+#include "ppu/ppu.hpp"
+#include "peripherals/joypad.hpp"
+#include "peripherals/timer.hpp"
+
+#include <string_view>
+
+namespace pedals::gameboy {
+	// the whole system in one object, the components are members and only hold plain pointers
+	// to each other so none of the hot state has to be reached through the heap or refcounted
+	class GameBoy {
+	public:
+		GameBoy(std::string_view rom_filename, pedals::ppu::Renderer renderer = pedals::ppu::Renderer::Scanline) :
+			m_Cartridge(rom_filename),
+			m_Bus(m_PPU, m_Joypad, m_Timer, m_Cartridge),
+			m_CPU(m_Bus) {
+			m_PPU.SetRenderer(renderer);
+			m_PPU.SetBus(m_Bus);
+			m_Timer.SetBus(m_Bus);
+		}
+
+		// the components point into this object, so it can not be copied or moved
+		GameBoy(const GameBoy&) = delete;
+		GameBoy& operator=(const GameBoy&) = delete;
+
+		pedals::cpu::SM83& GetCPU() {
+			return m_CPU;
+		}
+
+		pedals::bus::Bus& GetBus() {
+			return m_Bus;
+		}
+
+		pedals::ppu::PPU& GetPPU() {
+			return m_PPU;
+		}
+
+		pedals::timer::Timer& GetTimer() {
+			return m_Timer;
+		}
+
+		pedals::joypad::Joypad& GetJoypad() {
+			return m_Joypad;
+		}
+
+		pedals::cartridge::Cartridge& GetCartridge() {
+			return m_Cartridge;
+		}
+
+	private:
+		// in construction order, the bus maps the registers of everything above it
+		pedals::cartridge::Cartridge m_Cartridge;
+		pedals::ppu::PPU m_PPU;
+		pedals::timer::Timer m_Timer;
+		pedals::joypad::Joypad m_Joypad;
+		pedals::bus::Bus m_Bus;
+		pedals::cpu::SM83 m_CPU;
+	};
+}
+
+#endif
\ No newline at end of file
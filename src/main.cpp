@@ -1,9 +1,4 @@
-#include "cpu/cpu.hpp"
-#include "peripherals/bus.hpp"
-#include "cartridge/cartridge.hpp"
-#include "ppu/ppu.hpp"
-#include "peripherals/joypad.hpp"
-#include "peripherals/timer.hpp"
+#include "gameboy.hpp"
 
 #include "debugger.hpp"
 
@@ -11,6 +6,7 @@
 #include <fstream>
 #include <cstdio>
 #include <filesystem>
+#include <bitset>
 
 #include "thirdparty/imgui.h"
 #include "thirdparty/imgui_impl_sdl3.h"
@@ -19,9 +15,47 @@
 #include <SDL3/SDL.h>
 #include <SDL3_image/SDL_image.h>
 
-static uint32_t frame[WIDTH * HEIGHT];
 static uint32_t palette[5];
 
+// the PPU writes each line straight into the streaming texture. the whole texture is locked on the
+// first line after a present and unlocked by Flush() right before it is drawn, so every frame is one
+// lock and one upload and the texture is never locked while it is drawn
+struct TextureSink {
+	SDL_Texture* texture;
+
+	uint32_t* pixels = nullptr;
+	size_t pitch = 0;
+	std::bitset<HEIGHT> written {};
+
+	uint32_t* GetLine(size_t y) {
+		if (!pixels) {
+			void* locked;
+			int locked_pitch;
+			if (!SDL_LockTexture(texture, nullptr, &locked, &locked_pitch)) return nullptr;
+
+			pixels = static_cast<uint32_t*>(locked);
+			pitch = static_cast<size_t>(locked_pitch) / sizeof(uint32_t);
+			written.reset();
+		}
+
+		written.set(y);
+		return pixels + y * pitch;
+	}
+
+	// a lock only keeps the lines written since it was taken, a frame that was cut short (paused or
+	// the LCD just turned on) needs the rest written again before the upload
+	bool IsPartial() const {
+		return pixels && !written.all();
+	}
+
+	void Flush() {
+		if (!pixels) return;
+
+		SDL_UnlockTexture(texture);
+		pixels = nullptr;
+	}
+};
+
 static void init_palette(SDL_PixelFormat pfmt) {
 	const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(pfmt);
 	palette[0] = SDL_MapRGBA(fmt, nullptr, 0xc6, 0xde, 0x8c, 255);
@@ -40,11 +74,11 @@ static void file_callback(void* userdata, const char* const* filelist, int filte
 	(void)filter;
 }
 
-static std::string read_rom_title(std::shared_ptr<pedals::bus::Bus> bus) {
+static std::string read_rom_title(pedals::bus::Bus& bus) {
 	std::string title;
 
 	for (uint16_t address = 0x134; address <= 0x143; address++) {
-		uint8_t byte = bus->ReadMemory(address);
+		uint8_t byte = bus.ReadMemory(address);
 		if (byte == 0x00) break;
 		title += static_cast<char>(byte);
 	}
@@ -53,9 +87,16 @@ static std::string read_rom_title(std::shared_ptr<pedals::bus::Bus> bus) {
 }
 
 int main(int argc, char** argv) {
+	// --fifo picks the pixel FIFO renderer, anything else is the rom
 	std::string rom_name;
-	if (argc > 1) {
-		rom_name = argv[1];
+	pedals::ppu::Renderer ppu_renderer = pedals::ppu::Renderer::Scanline;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string_view(argv[i]) == "--fifo") {
+			ppu_renderer = pedals::ppu::Renderer::FIFO;
+		} else {
+			rom_name = argv[i];
+		}
 	}
 
 	// check for the dmg_boot.bin boot rom
@@ -108,23 +149,30 @@ int main(int argc, char** argv) {
 	init_palette(SDL_PIXELFORMAT_RGBA8888);
 
 	// initialize the main components and peripherals
-	auto ppu	= std::make_shared<pedals::ppu::PPU>();
-	auto timer	= std::make_shared<pedals::timer::Timer>();
-	auto joypad	= std::make_shared<pedals::joypad::Joypad>();
-	auto cart	= std::make_shared<pedals::cartridge::Cartridge>(rom_name);
-	auto bus	= std::make_shared<pedals::bus::Bus>(ppu, joypad, timer, cart);
-	auto cpu	= std::make_shared<pedals::cpu::SM83>(bus);
-	
-	// create the debug ui
-	pedals::debugger::DebugUI debug_ui(cpu, bus, timer, ppu, cart, palette);
+	auto gameboy = std::make_unique<pedals::gameboy::GameBoy>(rom_name, ppu_renderer);
+	auto& cpu = gameboy->GetCPU();
+	auto& bus = gameboy->GetBus();
+	auto& ppu = gameboy->GetPPU();
+	auto& joypad = gameboy->GetJoypad();
+
+	// hand the PPU the texture to draw into
+	TextureSink texture_sink { texture };
+	pedals::ppu::PixelSink pixel_sink;
+	pixel_sink.Bind<&TextureSink::GetLine>(texture_sink);
+	pixel_sink.SetColors({ palette[0], palette[1], palette[2], palette[3] });
+	ppu.SetPixelSink(&pixel_sink);
 
-	// we set the bus here to stop circular dependencies
-	ppu->SetBus(bus);
-	timer->SetBus(bus);
+	// create the debug ui
+	pedals::debugger::DebugUI debug_ui(*gameboy, palette);
 
 	// load boot ROM
-	bus->LoadBootROM("dmg_boot.bin");
-	cpu->Reset();
+	bus.LoadBootROM("dmg_boot.bin");
+	cpu.Reset();
+
+#if defined(PEDALS_AOT)
+	// use the statically recompiled blocks if they were generated from this rom
+	cpu.LoadPrecompiledBlocks(gameboy->GetCartridge().GetRawRef());
+#endif
 
 	// set the window title to show the title section inside the cartridge header
 	std::string window_title = "Pedals DMG - " + read_rom_title(bus);
@@ -152,32 +200,38 @@ int main(int argc, char** argv) {
 				case SDL_EVENT_KEY_DOWN:
 					// screenshot
 					if (event.key.key == SDLK_F12) {
-						SDL_Surface* temp_surface = SDL_CreateSurfaceFrom(WIDTH, HEIGHT, SDL_PIXELFORMAT_RGBA8888, frame, WIDTH * sizeof(uint32_t));
+						// the texture can not be read back, so this goes through the palette again
+						std::vector<uint32_t> screenshot(WIDTH * HEIGHT);
+						for (size_t i = 0; i < WIDTH * HEIGHT; i++) {
+							screenshot[i] = palette[ppu.GetFrame()[i]];
+						}
+
+						SDL_Surface* temp_surface = SDL_CreateSurfaceFrom(WIDTH, HEIGHT, SDL_PIXELFORMAT_RGBA8888, screenshot.data(), WIDTH * sizeof(uint32_t));
 						IMG_SavePNG(temp_surface, "screenshot.png");
 						SDL_DestroySurface(temp_surface);
 					}
 
 					// joypad
-					if (event.key.key == SDLK_S)		joypad->SetButtonState(pedals::joypad::Button::B, true);
-					if (event.key.key == SDLK_A)		joypad->SetButtonState(pedals::joypad::Button::A, true);
-					if (event.key.key == SDLK_RETURN)	joypad->SetButtonState(pedals::joypad::Button::Start, true);
-					if (event.key.key == SDLK_SPACE)	joypad->SetButtonState(pedals::joypad::Button::Select, true);
-					if (event.key.key == SDLK_UP)		joypad->SetButtonState(pedals::joypad::Button::Up, true);
-					if (event.key.key == SDLK_DOWN)		joypad->SetButtonState(pedals::joypad::Button::Down, true);
-					if (event.key.key == SDLK_LEFT)		joypad->SetButtonState(pedals::joypad::Button::Left, true);
-					if (event.key.key == SDLK_RIGHT)	joypad->SetButtonState(pedals::joypad::Button::Right, true);
+					if (event.key.key == SDLK_S)		joypad.SetButtonState(pedals::joypad::Button::B, true);
+					if (event.key.key == SDLK_A)		joypad.SetButtonState(pedals::joypad::Button::A, true);
+					if (event.key.key == SDLK_RETURN)	joypad.SetButtonState(pedals::joypad::Button::Start, true);
+					if (event.key.key == SDLK_SPACE)	joypad.SetButtonState(pedals::joypad::Button::Select, true);
+					if (event.key.key == SDLK_UP)		joypad.SetButtonState(pedals::joypad::Button::Up, true);
+					if (event.key.key == SDLK_DOWN)		joypad.SetButtonState(pedals::joypad::Button::Down, true);
+					if (event.key.key == SDLK_LEFT)		joypad.SetButtonState(pedals::joypad::Button::Left, true);
+					if (event.key.key == SDLK_RIGHT)	joypad.SetButtonState(pedals::joypad::Button::Right, true);
 					break;
 
 				case SDL_EVENT_KEY_UP:
 					// joypad
-					if (event.key.key == SDLK_S)		joypad->SetButtonState(pedals::joypad::Button::B, false);
-					if (event.key.key == SDLK_A)		joypad->SetButtonState(pedals::joypad::Button::A, false);
-					if (event.key.key == SDLK_RETURN)	joypad->SetButtonState(pedals::joypad::Button::Start, false);
-					if (event.key.key == SDLK_SPACE)	joypad->SetButtonState(pedals::joypad::Button::Select, false);
-					if (event.key.key == SDLK_UP)		joypad->SetButtonState(pedals::joypad::Button::Up, false);
-					if (event.key.key == SDLK_DOWN)		joypad->SetButtonState(pedals::joypad::Button::Down, false);
-					if (event.key.key == SDLK_LEFT)		joypad->SetButtonState(pedals::joypad::Button::Left, false);
-					if (event.key.key == SDLK_RIGHT)	joypad->SetButtonState(pedals::joypad::Button::Right, false);
+					if (event.key.key == SDLK_S)		joypad.SetButtonState(pedals::joypad::Button::B, false);
+					if (event.key.key == SDLK_A)		joypad.SetButtonState(pedals::joypad::Button::A, false);
+					if (event.key.key == SDLK_RETURN)	joypad.SetButtonState(pedals::joypad::Button::Start, false);
+					if (event.key.key == SDLK_SPACE)	joypad.SetButtonState(pedals::joypad::Button::Select, false);
+					if (event.key.key == SDLK_UP)		joypad.SetButtonState(pedals::joypad::Button::Up, false);
+					if (event.key.key == SDLK_DOWN)		joypad.SetButtonState(pedals::joypad::Button::Down, false);
+					if (event.key.key == SDLK_LEFT)		joypad.SetButtonState(pedals::joypad::Button::Left, false);
+					if (event.key.key == SDLK_RIGHT)	joypad.SetButtonState(pedals::joypad::Button::Right, false);
 					break;
 			}
 		}
@@ -185,29 +239,31 @@ int main(int argc, char** argv) {
 		// run a frame worth of emulation
 		uint32_t frame_cycles = 0;
 		while (frame_cycles < cycles_per_frame && !debug_ui.GetSingleStep()) {
-			uint8_t step_cycles = cpu->Step();
-			frame_cycles += step_cycles;
-
-			for (size_t i = 0; i < step_cycles; i++) {
-				ppu->Tick();
-				timer->Tick();
+			// nothing has to be checked between instructions so let the CPU run the rest of the frame
+			if (!debug_ui.GetBreakOnInterrupt() && !debug_ui.GetBreakOnRETI()) {
+				frame_cycles += cpu.Run(cycles_per_frame - frame_cycles);
+				break;
 			}
 
-			if (debug_ui.GetBreakOnInterrupt() && cpu->InInterrupt()) {
+			uint32_t step_cycles = cpu.Step(cycles_per_frame - frame_cycles);
+			frame_cycles += step_cycles;
+			bus.Tick(step_cycles);
+
+			if (debug_ui.GetBreakOnInterrupt() && cpu.InInterrupt()) {
 				debug_ui.GetSingleStep() = true;
 				debug_ui.GetBreakOnInterrupt() = false;
 			}
 
-			if (debug_ui.GetBreakOnRETI() && cpu->GetRETIRef() && !cpu->InInterrupt()) {
+			if (debug_ui.GetBreakOnRETI() && cpu.GetRETIRef() && !cpu.InInterrupt()) {
 				debug_ui.GetSingleStep() = true;
 				debug_ui.GetBreakOnRETI() = false;
-				cpu->GetRETIRef() = false;
+				cpu.GetRETIRef() = false;
 			}
 		}
 
 		// render the window if the PPU says we should render
 		// or if we are single stepping to stop the window from timing out
-		if (ppu->ShouldRender() || debug_ui.GetSingleStep()) {
+		if (ppu.ShouldRender() || debug_ui.GetSingleStep()) {
 			// begin imgui frame
 			ImGui_ImplSDLRenderer3_NewFrame();
 			ImGui_ImplSDL3_NewFrame();
@@ -217,13 +273,9 @@ int main(int argc, char** argv) {
 			// render the debug ui
 			debug_ui.Draw();
 
-			// convert the ppu indexed image to an RGBA array
-			for (size_t i = 0; i < WIDTH * HEIGHT; i++) {
-				frame[i] = palette[ppu->GetFrame()[i]];
-			}
-
-			// update the SDL texture
-			SDL_UpdateTexture(texture, nullptr, frame, WIDTH * sizeof(uint32_t));
+			// the texture already has every finished line, when paused the PPU is brought up to the
+			// CPU first so the LCD shows where it stopped
+			if (debug_ui.GetSingleStep()) ppu.Sync();
 
 			// LCD viewport
 			ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
@@ -258,6 +310,10 @@ int main(int argc, char** argv) {
 			ImGui::Render();
 			SDL_RenderClear(renderer);
 
+			// upload what the PPU wrote since the last present, the texture has to be unlocked to be drawn
+			if (texture_sink.IsPartial()) ppu.OutputFrame();
+			texture_sink.Flush();
+
 			// render and present the drawlist
 			ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), renderer);
 			SDL_RenderPresent(renderer);
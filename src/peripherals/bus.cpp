@@ -1,200 +1,281 @@
 #include "bus.hpp"
 #include <print>
+#include <cstring>
 
 using namespace pedals::bus;
 
-#define RouteRange(start, end) if (address >= start && address <= end)
-#define RouteRead(addr, func) if (address == addr) { return func(addr); }
-#define RouteWrite(addr, func) if (address == addr) { func(addr, value); return; }
-
-uint8_t Bus::ReadMemory(uint16_t address) {
-	if (address >= 0x0000 && address <= 0x00ff) {
-		if (m_DisableBootROM) {
-			return m_Cartridge->GetMBC()->Read(address);
-		}
-		
-		return m_BootROM[address];
+void Bus::MapPages() {
+	for (int page = 0x80; page < 0xa0; page++) {
+		m_Pages[page] = { m_PPU->GetVRAMRef().data() + ((page - 0x80) << 8), PageHandler::VideoRAM };
 	}
 
-	RouteRange(0x00ff, 0x7fff) {
-		return m_Cartridge->GetMBC()->Read(address);
+	for (int page = 0xa0; page < 0xc0; page++) {
+		m_Pages[page] = { nullptr, PageHandler::CartridgeRAM };
 	}
 
-	RouteRange(0x8000, 0x9fff) {
-		return m_PPU->ReadVRAM(address);
+	// echo RAM included
+	for (int page = 0xc0; page < 0xfe; page++) {
+		m_Pages[page] = { m_WorkRAM.data() + ((page << 8) & 0x1fff), PageHandler::WorkRAM };
 	}
 
-	RouteRange(0xa000, 0xbfff) {
-		return m_Cartridge->GetMBC()->Read(address);
-	}
+	m_Pages[0xfe] = { nullptr, PageHandler::OAM };
+	m_Pages[0xff] = { nullptr, PageHandler::IO };
+
+	UpdateROMPages();
+}
+
+void Bus::UpdateROMPages() {
+	for (uint16_t bank_start : { 0x0000, 0x4000 }) {
+		const uint8_t* bank = m_Cartridge->GetROMBankData(bank_start);
 
-	RouteRange(0xc000, 0xcfff) {
-		return m_WorkRAM[address - 0xc000];
+		for (int page = 0; page < 0x40; page++) {
+			m_Pages[(bank_start >> 8) + page] = { (bank != nullptr) ? bank + (page << 8) : nullptr, PageHandler::ROM };
+		}
 	}
 
-	RouteRange(0xd000, 0xdfff) {
-		return m_WorkRAM[address - 0xc000];
+	if (!m_DisableBootROM) {
+		m_Pages[0x00] = { (m_BootROM.size() >= 0x100) ? m_BootROM.data() : nullptr, PageHandler::ROM };
 	}
 
-	RouteRange(0xe000, 0xfdff) {
-		return m_WorkRAM[address - 0xe000];
+	m_MappingGeneration++;
+}
+
+void Bus::MapIO() {
+	for (uint32_t address = 0xff00; address <= 0xffff; address++) {
+		m_IO.Map<&Bus::ReadUnknown, &Bus::WriteUnknown>(address, *this);
 	}
 
-	RouteRange(0xff80, 0xfffe) {
-		return m_HighRAM[address - 0xff80];
+	for (uint16_t address = 0xff10; address <= 0xff3f; address++) {
+		m_IO.Map<&Bus::ReadAPU, &Bus::WriteIgnored>(address, *this);
 	}
 
-	// not usable
-	RouteRange(0xfea0, 0xfeff) {
-		return 0xff;
+	for (uint16_t address = 0xff4c; address <= 0xff7f; address++) {
+		m_IO.Map<&Bus::ReadUnused, &Bus::WriteIgnored>(address, *this);
 	}
 
-	// PPU OAM
-	RouteRange(0xfe00, 0xfe9f) {
-		return m_PPU->ReadOAM(address);
+	for (uint16_t address = 0xff80; address <= 0xfffe; address++) {
+		m_IO.Map<&Bus::ReadHighRAM, &Bus::WriteHighRAM>(address, *this);
 	}
 
-	// Joypad
-	RouteRead(0xff00, m_Joypad->ReadP1);
+	// serial
+	m_IO.Map<&Bus::ReadSB, &Bus::WriteSB>(0xff01, *this);
+	m_IO.Map<&Bus::ReadSC, &Bus::WriteSC>(0xff02, *this);
 
-	// Serial
-	RouteRead(0xff01, ReadSB);
-	RouteRead(0xff02, ReadSC);
+	// interrupts
+	m_IO.Map<&Bus::ReadIF, &Bus::WriteIF>(0xff0f, *this);
+	m_IO.Map<&Bus::ReadIE, &Bus::WriteIE>(0xffff, *this);
 
-	// Timer
-	RouteRead(0xff04, m_Timer->ReadDIV);
-	RouteRead(0xff05, m_Timer->ReadTIMA);
-	RouteRead(0xff06, m_Timer->ReadTMA);
-	RouteRead(0xff07, m_Timer->ReadTAC);
+	m_IO.MapWrite<&Bus::DisableBootROM>(0xff50, *this);
 
-	// PPU registers
-	RouteRead(0xff40, m_PPU->GetLCDControlRegister().Read);
-	RouteRead(0xff41, m_PPU->GetLCDStatusRegister().Read);
-	RouteRead(0xff42, m_PPU->ReadSCY);
-	RouteRead(0xff43, m_PPU->ReadSCX);
-	RouteRead(0xff44, m_PPU->ReadLY);
-	RouteRead(0xff45, m_PPU->ReadLYC);
-	RouteRead(0xff47, m_PPU->ReadBGP);
-	RouteRead(0xff48, m_PPU->ReadOBP0);
-	RouteRead(0xff49, m_PPU->ReadOBP1);
-	RouteRead(0xff4a, m_PPU->ReadWX);
-	RouteRead(0xff4b, m_PPU->ReadWY);
+	m_Joypad->MapIO(m_IO);
+	m_Timer->MapIO(m_IO);
+	m_PPU->MapIO(m_IO);
+}
 
-	// suppress unknown APU registers because it will not be implemented for now
-	RouteRange(0xff10, 0xff3f) {
-		return 0;
-	}
+uint8_t Bus::ReadHandler(uint16_t address) {
+	switch (m_Pages[address >> 8].handler) {
+		case PageHandler::ROM: {
+			if (address <= 0x00ff && !m_DisableBootROM) {
+				return (address < m_BootROM.size()) ? m_BootROM[address] : 0xff;
+			}
 
-	// unused CGB registers
-	RouteRange(0xff4c, 0xff7f) {
-		return 0xff;
-	}
+			return m_Cartridge->Read(address);
+		}
 
-	// interrupts
-	RouteRead(0xff0f, ReadIF);
-	RouteRead(0xffff, ReadIE);
+		case PageHandler::CartridgeRAM:
+			return m_Cartridge->Read(address);
+
+		case PageHandler::VideoRAM:
+			return m_PPU->ReadVRAM(address);
+
+		case PageHandler::WorkRAM:
+			return m_WorkRAM[address & 0x1fff];
+
+		case PageHandler::OAM: {
+			// 0xfea0-0xfeff is not usable
+			if (address >= 0xfea0) return 0xff;
+			return m_PPU->ReadOAM(address);
+		}
+
+		case PageHandler::IO:
+			return m_IO.Read(address);
+	}
 
-	std::println("bus: attempted to read from unknown address {:x}", address);
 	return 0xff;
 }
 
 void Bus::WriteMemory(uint16_t address, uint8_t value) {
-	RouteRange(0x0000, 0x00ff) {
-		if (!m_DisableBootROM) {
-			std::println("bus: attempted to write {:x} -> {:x} in boot rom!", value, address);
+	switch (m_Pages[address >> 8].handler) {
+		case PageHandler::ROM: {
+			if (address <= 0x00ff && !m_DisableBootROM) {
+				std::println("bus: attempted to write {:x} -> {:x} in boot rom!", value, address);
+			}
+
+			// most MBC writes (RAM enable, the same bank again) leave the banks alone, only a real
+			// switch remaps the pages and makes the CPU drop what it has cached from the old ones
+			const uint8_t* low_bank = m_Cartridge->GetROMBankData(0x0000);
+			const uint8_t* high_bank = m_Cartridge->GetROMBankData(0x4000);
+
+			m_Cartridge->Write(address, value);
+
+			if (m_Cartridge->GetROMBankData(0x0000) != low_bank || m_Cartridge->GetROMBankData(0x4000) != high_bank) {
+				UpdateROMPages();
+			}
+
+			return;
 		}
 
-		m_Cartridge->GetMBC()->Write(address, value);
-		return;
-	}
-	
-	RouteRange(0x00ff, 0x7fff) {
-		m_Cartridge->GetMBC()->Write(address, value);
-		return;
-	}
+		case PageHandler::CartridgeRAM:
+			m_Cartridge->Write(address, value);
+			return;
+
+		// the PPU has to render everything before the write with the old contents
+		case PageHandler::VideoRAM:
+			m_PPU->Sync();
+			m_PPU->WriteVRAM(address, value);
+			return;
+
+		case PageHandler::WorkRAM:
+			m_WorkRAM[address & 0x1fff] = value;
+			StampWrite(address);
+			return;
+
+		case PageHandler::OAM: {
+			// 0xfea0-0xfeff is not usable
+			if (address < 0xfea0) {
+				m_PPU->Sync();
+				m_PPU->WriteOAM(address, value);
+			}
+
+			return;
+		}
 
-	RouteRange(0x8000, 0x9fff) {
-		m_PPU->WriteVRAM(address, value);
-		return;
+		case PageHandler::IO:
+			m_IO.Write(address, value);
+			return;
 	}
+}
 
-	RouteRange(0xa000, 0xbfff) {
-		m_Cartridge->GetMBC()->Write(address, value);
-		return;
+Bus::FetchRegion Bus::GetFetchRegion(uint16_t address) {
+	if (address < 0x0100 && !m_DisableBootROM) {
+		if (m_BootROM.size() < 0x100) return { nullptr, 0x0000, 0x0100 };
+		return { m_BootROM.data(), 0x0000, 0x0100 };
 	}
 
-	RouteRange(0xc000, 0xcfff) {
-		m_WorkRAM[address - 0xc000] = value;
-		return;
-	}
+	if (address < 0x8000) {
+		// bank 0 starts after the boot ROM while it is still mapped
+		uint16_t bank_start = address & 0xc000;
+		uint16_t start = (bank_start == 0 && !m_DisableBootROM) ? 0x0100 : bank_start;
 
-	RouteRange(0xd000, 0xdfff) {
-		m_WorkRAM[address - 0xc000] = value;
-		return;
+		const uint8_t* bank = m_Cartridge->GetROMBankData(address);
+		if (bank == nullptr) return { nullptr, start, bank_start + 0x4000u };
+		return { bank + (start - bank_start), start, bank_start + 0x4000u };
 	}
 
-	RouteRange(0xe000, 0xfdff) {
-		m_WorkRAM[address - 0xe000] = value;
-		return;
+	if (address < 0xa000) return { m_PPU->GetVRAMRef().data(), 0x8000, 0xa000 };
+	if (address < 0xc000) return { nullptr, 0xa000, 0xc000 };
+	if (address < 0xe000) return { m_WorkRAM.data(), 0xc000, 0xe000 };
+	if (address < 0xfe00) return { m_WorkRAM.data(), 0xe000, 0xfe00 };
+	if (address < 0xff80) return { nullptr, 0xfe00, 0xff80 };
+	if (address < 0xffff) return { m_HighRAM.data(), 0xff80, 0xffff };
+	return { nullptr, 0xffff, 0x10000 };
+}
+
+uint16_t Bus::FillMemory(uint16_t address, int step, uint8_t value, uint16_t count) {
+	PlainMemory memory = GetPlainMemory(address);
+	if (memory.data == nullptr) {
+		return 0;
 	}
-	
-	RouteRange(0xff80, 0xfffe) {
-		m_HighRAM[address - 0xff80] = value;
-		return;
+
+	// ld (hl-), a fills go down from address
+	uint16_t first = address;
+	if (step > 0) {
+		count = static_cast<uint16_t>(std::min<uint32_t>(count, memory.end - address));
+	} else {
+		count = static_cast<uint16_t>(std::min<uint32_t>(count, address - memory.start + 1));
+		first = address - count + 1;
 	}
 
-	// not usable
-	RouteRange(0xfea0, 0xfeff) {
-		return;
+	if (memory.data == m_PPU->GetVRAMRef().data()) {
+		m_PPU->Sync();
 	}
 
-	// PPU OAM
-	RouteRange(0xfe00, 0xfe9f) {
-		return m_PPU->WriteOAM(address, value);
+	std::memset(memory.data + (first - memory.start), value, count);
+
+	if (memory.data == m_WorkRAM.data()) {
+		StampWrites(first, count);
+	} else {
+		m_PPU->InvalidateTiles(first, count);
 	}
 
-	// Serial
-	RouteWrite(0xff01, WriteSB);
-	RouteWrite(0xff02, WriteSC);
-	
-	// Timer
-	RouteWrite(0xff04, m_Timer->WriteDIV);
-	RouteWrite(0xff05, m_Timer->WriteTIMA);
-	RouteWrite(0xff06, m_Timer->WriteTMA);
-	RouteWrite(0xff07, m_Timer->WriteTAC);
+	return count;
+}
+
+uint16_t Bus::CopyMemory(uint16_t destination, uint16_t source, uint16_t count) {
+	PlainMemory to = GetPlainMemory(destination);
+	if (to.data == nullptr) {
+		return 0;
+	}
 
-	// Joypad
-	RouteWrite(0xff00, m_Joypad->WriteP1);
+	if (to.data == m_PPU->GetVRAMRef().data()) {
+		m_PPU->Sync();
+	}
 
-	// PPU registers
-	RouteWrite(0xff40, m_PPU->GetLCDControlRegister().Write)
-	RouteWrite(0xff41, m_PPU->GetLCDStatusRegister().Write);
-	RouteWrite(0xff42, m_PPU->WriteSCY);
-	RouteWrite(0xff43, m_PPU->WriteSCX);
-	RouteWrite(0xff45, m_PPU->WriteLYC);
-	RouteWrite(0xff46, m_PPU->DMATransferOAM);
-	RouteWrite(0xff47, m_PPU->WriteBGP);
-	RouteWrite(0xff48, m_PPU->WriteOBP0);
-	RouteWrite(0xff49, m_PPU->WriteOBP1);
-	RouteWrite(0xff4a, m_PPU->WriteWX);
-	RouteWrite(0xff4b, m_PPU->WriteWY);
+	count = static_cast<uint16_t>(std::min<uint32_t>(count, to.end - destination));
+	uint8_t* out = to.data + (destination - to.start);
 
-	// I/O registers
-	RouteWrite(0xff50, DisableBootROM);
+	PlainMemory from = GetPlainMemory(source);
+	if (from.data != nullptr) {
+		count = static_cast<uint16_t>(std::min<uint32_t>(count, from.end - source));
+		const uint8_t* in = from.data + (source - from.start);
 
-	// unused CGB registers
-	RouteRange(0xff4c, 0xff7f) {
-		return;
+		// copying to just ahead of the source repeats what was just written, like the CPU loop would
+		if (from.data == to.data && destination > source && destination < source + count) {
+			for (uint16_t i = 0; i < count; i++) out[i] = in[i];
+		} else {
+			std::memmove(out, in, count);
+		}
+	} else if (source < 0x8000) {
+		// ROM (or the boot ROM) has to go through the MBC
+		count = static_cast<uint16_t>(std::min<uint32_t>(count, 0x8000 - source));
+		for (uint16_t i = 0; i < count; i++) out[i] = ReadMemory(source + i);
+	} else {
+		return 0;
 	}
 
-	// suppress unknown APU registers because it will not be implemented for now
-	RouteRange(0xff10, 0xff3f) {
-		return;
+	if (count > 0 && to.data == m_WorkRAM.data()) {
+		StampWrites(destination, count);
+	} else if (count > 0) {
+		m_PPU->InvalidateTiles(destination, count);
 	}
 
-	// interrupt stuff
-	RouteWrite(0xff0f, WriteIF);
-	RouteWrite(0xffff, WriteIE);
+	return count;
+}
 
-	std::println("bus: attempted to write {:x} -> unknown address {:x}", value, address);
+void Bus::Tick(uint32_t cycles) {
+	m_Scheduler.Advance(cycles);
+
+	// the components catch up to now when their event runs, everything in between is skipped
+	while (m_Scheduler.IsDue()) {
+		switch (m_Scheduler.Pop()) {
+			case pedals::scheduler::Event::PPU: {
+				m_PPU->Sync();
+				m_PPU->Schedule();
+				break;
+			}
+
+			case pedals::scheduler::Event::Timer: {
+				m_Timer->Sync();
+				m_Timer->Schedule();
+				break;
+			}
+
+			case pedals::scheduler::Event::Serial: {
+				FinishSerialTransfer();
+				break;
+			}
+
+			default: break;
+		}
+	}
 }
\ No newline at end of file
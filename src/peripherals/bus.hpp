@@ -5,11 +5,16 @@
 #include "../cartridge/cartridge.hpp"
 #include "joypad.hpp"
 #include "timer.hpp"
+#include "io.hpp"
+#include "scheduler.hpp"
 
 #include <stdint.h>
 #include <memory>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <print>
+#include <limits>
 
 #include <fstream>
 #include <string>
@@ -26,20 +31,32 @@ namespace pedals::bus {
 
 	class Bus {
 	public:
-		Bus(std::shared_ptr<pedals::ppu::PPU> ppu, std::shared_ptr<pedals::joypad::Joypad> joypad, std::shared_ptr<pedals::timer::Timer> timer, std::shared_ptr<pedals::cartridge::Cartridge> cart) :
-			m_PPU(ppu),
-			m_Joypad(joypad),
-			m_Timer(timer),
-			m_Cartridge(cart),
+		Bus(pedals::ppu::PPU& ppu, pedals::joypad::Joypad& joypad, pedals::timer::Timer& timer, pedals::cartridge::Cartridge& cart) :
+			m_PPU(&ppu),
+			m_Joypad(&joypad),
+			m_Timer(&timer),
+			m_Cartridge(&cart),
 			m_BootROM(256, 0),
 			m_WorkRAM(0x2000, 0),
-			m_HighRAM(0x7f, 0) {}
+			m_HighRAM(0x7f, 0) {
+			MapPages();
+			MapIO();
+		}
+
+		uint8_t ReadMemory(uint16_t address) {
+			const Page& page = m_Pages[address >> 8];
+			if (page.data != nullptr) {
+				return page.data[address & 0xff];
+			}
+
+			return ReadHandler(address);
+		}
 
-		uint8_t ReadMemory(uint16_t address);
 		void WriteMemory(uint16_t address, uint8_t value);
 
 		void LoadBootROM(const std::vector<uint8_t>& rom) {
 			m_BootROM = rom;
+			UpdateROMPages();
 		}
 
 		void LoadBootROM(std::string_view filename) {
@@ -60,6 +77,7 @@ namespace pedals::bus {
 
 		void SetBootROMVisibility(bool enable) {
 			m_DisableBootROM = !enable;
+			UpdateROMPages();
 		}
 		
 		uint16_t ReadMemory16(uint16_t address) {
@@ -73,6 +91,78 @@ namespace pedals::bus {
 			WriteMemory(address + 1, (value >> 8) & 0xff);
 		}
 
+		bool IsBootROMMapped() const {
+			return !m_DisableBootROM;
+		}
+
+		uint32_t GetROMBank(uint16_t address) {
+			return m_Cartridge->GetROMBank(address);
+		}
+
+		// bumped whenever something that could change what is mapped at 0x0000-0x7fff is written
+		uint32_t GetMappingGeneration() const {
+			return m_MappingGeneration;
+		}
+
+		// a stretch of memory instructions can be fetched from with a plain pointer read, data points
+		// at start and is nullptr if reads in it have to go through ReadMemory()
+		struct FetchRegion {
+			const uint8_t* data = nullptr;
+			uint16_t start = 0;
+			uint32_t end = 0;
+		};
+
+		// the region address is in, it stays valid until the mapping generation changes
+		FetchRegion GetFetchRegion(uint16_t address);
+
+		// every write to work RAM or high RAM stamps its 64 byte line with an increasing counter,
+		// so decoded code from those regions can tell if it has been overwritten
+		uint64_t GetWriteCounter() const {
+			return m_WriteCounter;
+		}
+
+		uint64_t GetWriteStamp(uint16_t address) const {
+			return m_WriteStamps[WriteStampLine(address)];
+		}
+
+		// run a CPU fill or copy loop in one go, byte by byte in the same order the CPU would go, only
+		// VRAM and work RAM can be written (and also ROM read), stops at the end of the memory area and
+		// returns how many bytes were done
+		uint16_t FillMemory(uint16_t address, int step, uint8_t value, uint16_t count);
+		uint16_t CopyMemory(uint16_t destination, uint16_t source, uint16_t count);
+
+		// advance the clock by the T-cycles the last CPU step took and run the events that came up
+		void Tick(uint32_t cycles);
+
+		// T-cycles ticked since power on
+		uint64_t GetCycles() const {
+			return m_Scheduler.GetNow();
+		}
+
+		// how many T-cycles can pass before the next event has to run, which is also the earliest
+		// anything could request an interrupt
+		uint32_t CyclesUntilNextEvent() const {
+			uint64_t next = m_Scheduler.GetNextTime();
+			uint64_t now = m_Scheduler.GetNow();
+
+			if (next <= now) return 0;
+			return static_cast<uint32_t>(std::min<uint64_t>(next - now - 1, std::numeric_limits<uint32_t>::max()));
+		}
+
+		// the PPU only catches up when it is accessed, so neither LY and STAT staying the same nor VRAM
+		// writes done ahead of time (like the copy loops) can be assumed past this
+		uint32_t CyclesUntilPPUActive() {
+			return m_PPU->CyclesUntilActive();
+		}
+
+		void ScheduleEvent(pedals::scheduler::Event event, uint64_t time) {
+			m_Scheduler.Schedule(event, time);
+		}
+
+		void CancelEvent(pedals::scheduler::Event event) {
+			m_Scheduler.Cancel(event);
+		}
+
 		void RequestInterrupt(InterruptFlag interrupt) {
 			WriteMemory(0xff0f, ReadMemory(0xff0f) | interrupt);
 		}
@@ -123,6 +213,94 @@ namespace pedals::bus {
 		void DisableBootROM(uint16_t, uint8_t) {
 			//std::println("bus: disabled boot ROM access");
 			m_DisableBootROM = true;
+			UpdateROMPages();
+		}
+
+		// what an access to a page has to go through when it can not use the page's data
+		enum class PageHandler : uint8_t {
+			ROM,
+			CartridgeRAM,
+			VideoRAM,
+			WorkRAM,
+			OAM,
+			IO,
+		};
+
+		// one of the 256 byte pages of the address space, data is the host memory reads of
+		// the page come from and is nullptr if they have side effects or nothing is mapped
+		struct Page {
+			const uint8_t* data = nullptr;
+			PageHandler handler = PageHandler::IO;
+		};
+
+		void MapPages();
+
+		// points the ROM pages at what the boot ROM and the MBC map right now, this has to be
+		// called after anything that could change that and bumps the mapping generation
+		void UpdateROMPages();
+
+		uint8_t ReadHandler(uint16_t address);
+
+		// fills in the I/O handlers of the bus itself and of the components
+		void MapIO();
+
+		// echo RAM shares the lines of the work RAM it mirrors
+		static uint16_t WriteStampLine(uint16_t address) {
+			if (address >= 0xe000 && address < 0xfe00) address -= 0x2000;
+			return (address - 0xc000) >> 6;
+		}
+
+		void StampWrite(uint16_t address) {
+			m_WriteStamps[WriteStampLine(address)] = ++m_WriteCounter;
+		}
+
+		void StampWrites(uint16_t address, uint16_t count) {
+			for (uint16_t line = WriteStampLine(address); line <= WriteStampLine(address + count - 1); line++) {
+				m_WriteStamps[line] = ++m_WriteCounter;
+			}
+		}
+
+		// memory that can be read and written without side effects
+		struct PlainMemory {
+			uint8_t* data = nullptr;
+			uint16_t start = 0;
+			uint32_t end = 0;
+		};
+
+		PlainMemory GetPlainMemory(uint16_t address) {
+			if (address >= 0x8000 && address < 0xa000) return { m_PPU->GetVRAMRef().data(), 0x8000, 0xa000 };
+			if (address >= 0xc000 && address < 0xe000) return { m_WorkRAM.data(), 0xc000, 0xe000 };
+			return {};
+		}
+
+		uint8_t ReadUnknown(uint16_t address) {
+			std::println("bus: attempted to read from unknown address {:x}", address);
+			return 0xff;
+		}
+
+		void WriteUnknown(uint16_t address, uint8_t value) {
+			std::println("bus: attempted to write {:x} -> unknown address {:x}", value, address);
+		}
+
+		// unknown APU registers are suppressed because it will not be implemented for now
+		uint8_t ReadAPU(uint16_t) {
+			return 0;
+		}
+
+		// unused CGB registers
+		uint8_t ReadUnused(uint16_t) {
+			return 0xff;
+		}
+
+		void WriteIgnored(uint16_t, uint8_t) {}
+
+		uint8_t ReadHighRAM(uint16_t address) {
+			return m_HighRAM[address - 0xff80];
+		}
+
+		void WriteHighRAM(uint16_t address, uint8_t value) {
+			m_HighRAM[address - 0xff80] = value;
+			StampWrite(address);
 		}
 
 		uint8_t ReadSB(uint16_t) {
@@ -140,12 +318,20 @@ namespace pedals::bus {
 		void WriteSC(uint16_t, uint8_t value) {
 			m_SC = value;
 
-			if (value == 0x81) {
-				m_SC = 0;
+			// a transfer on the internal clock shifts the 8 bits out at 8192 Hz
+			if ((value & 0x81) == 0x81) {
 				//printf("%c", ReadMemory(0xff01));
+				ScheduleEvent(pedals::scheduler::Event::Serial, GetCycles() + 8 * 512);
 			}
 		}
 
+		// nothing is ever connected, so the bits shifted in are all 1
+		void FinishSerialTransfer() {
+			m_SB = 0xff;
+			m_SC &= 0x7f;
+			RequestInterrupt(InterruptFlag::Serial);
+		}
+
 		void WriteIE(uint16_t, uint8_t value) {
 			SetIE(value);
 		}
@@ -176,10 +362,20 @@ namespace pedals::bus {
 
 		bool m_DisableBootROM = false;
 
-		std::shared_ptr<pedals::ppu::PPU> m_PPU;
-		std::shared_ptr<pedals::joypad::Joypad> m_Joypad;
-		std::shared_ptr<pedals::timer::Timer> m_Timer;
-		std::shared_ptr<pedals::cartridge::Cartridge> m_Cartridge;
+		std::array<Page, 256> m_Pages;
+		IOMap m_IO;
+
+		pedals::scheduler::Scheduler m_Scheduler;
+
+		uint32_t m_MappingGeneration = 0;
+		uint64_t m_WriteCounter = 0;
+		std::array<uint64_t, 0x4000 / 64> m_WriteStamps {};
+
+		// owned by the GameBoy along with the bus
+		pedals::ppu::PPU* m_PPU;
+		pedals::joypad::Joypad* m_Joypad;
+		pedals::timer::Timer* m_Timer;
+		pedals::cartridge::Cartridge* m_Cartridge;
 	};
 }
 
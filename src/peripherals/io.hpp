@@ -0,0 +1,86 @@
+#ifndef IO_HPP
+#define IO_HPP
+
+#include <stdint.h>
+#include <array>
+
+namespace pedals::bus {
+	// read and write handlers for the 0xff00-0xffff page, one per register, so an access is a
+	// single indirect call. the bus and the components whose registers live there fill it in
+	// when the bus is built
+	class IOMap {
+	public:
+		template <auto read, typename T>
+		void MapRead(uint16_t address, T& owner) {
+			m_Reads[address & 0xff] = { &owner, [](void* context, uint16_t address) -> uint8_t {
+				return (static_cast<T*>(context)->*read)(address);
+			} };
+		}
+
+		template <auto write, typename T>
+		void MapWrite(uint16_t address, T& owner) {
+			m_Writes[address & 0xff] = { &owner, [](void* context, uint16_t address, uint8_t value) {
+				(static_cast<T*>(context)->*write)(address, value);
+			} };
+		}
+
+		template <auto read, auto write, typename T>
+		void Map(uint16_t address, T& owner) {
+			MapRead<read>(address, owner);
+			MapWrite<write>(address, owner);
+		}
+
+		// for components that are only brought up to date when needed, owner.Sync() runs before
+		// every access and owner.Schedule() after every write since it could move their next event
+		template <auto read, typename T>
+		void MapSyncedRead(uint16_t address, T& owner) {
+			m_Reads[address & 0xff] = { &owner, [](void* context, uint16_t address) -> uint8_t {
+				T* component = static_cast<T*>(context);
+				component->Sync();
+				return (component->*read)(address);
+			} };
+		}
+
+		template <auto write, typename T>
+		void MapSyncedWrite(uint16_t address, T& owner) {
+			m_Writes[address & 0xff] = { &owner, [](void* context, uint16_t address, uint8_t value) {
+				T* component = static_cast<T*>(context);
+				component->Sync();
+				(component->*write)(address, value);
+				component->Schedule();
+			} };
+		}
+
+		template <auto read, auto write, typename T>
+		void MapSynced(uint16_t address, T& owner) {
+			MapSyncedRead<read>(address, owner);
+			MapSyncedWrite<write>(address, owner);
+		}
+
+		uint8_t Read(uint16_t address) const {
+			const ReadHandler& handler = m_Reads[address & 0xff];
+			return handler.function(handler.context, address);
+		}
+
+		void Write(uint16_t address, uint8_t value) const {
+			const WriteHandler& handler = m_Writes[address & 0xff];
+			handler.function(handler.context, address, value);
+		}
+
+	private:
+		struct ReadHandler {
+			void* context = nullptr;
+			uint8_t (*function)(void*, uint16_t) = nullptr;
+		};
+
+		struct WriteHandler {
+			void* context = nullptr;
+			void (*function)(void*, uint16_t, uint8_t) = nullptr;
+		};
+
+		std::array<ReadHandler, 0x100> m_Reads {};
+		std::array<WriteHandler, 0x100> m_Writes {};
+	};
+}
+
+#endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef JOYPAD_HPP
 #define JOYPAD_HPP
 
+#include "io.hpp"
+
 #include <stdint.h>
 #include <print>
 
@@ -60,6 +62,10 @@ namespace pedals::joypad {
 
 		void WriteP1(uint16_t, uint8_t bits) { SetP1(bits); }
 
+		void MapIO(pedals::bus::IOMap& io) {
+			io.Map<&Joypad::ReadP1, &Joypad::WriteP1>(0xff00, *this);
+		}
+
 	private:
 		uint8_t m_TopNibble = 0;
 		uint8_t m_Buttons = 0xff;
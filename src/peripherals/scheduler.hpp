@@ -0,0 +1,144 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <stdint.h>
+#include <array>
+#include <limits>
+#include <utility>
+
+namespace pedals::scheduler {
+	// everything that has to happen at a certain cycle, there is at most one of each pending
+	enum class Event : uint8_t {
+		PPU,
+		Timer,
+		Serial,
+
+		Count,
+	};
+
+	// the global T-cycle clock and a min-heap of the events waiting on it, the components are
+	// left alone until their event comes up (or the CPU touches one of their registers)
+	class Scheduler {
+	public:
+		static constexpr uint64_t never = std::numeric_limits<uint64_t>::max();
+
+		Scheduler() {
+			m_Positions.fill(none);
+		}
+
+		// T-cycles since power on
+		uint64_t GetNow() const {
+			return m_Now;
+		}
+
+		void Advance(uint32_t cycles) {
+			m_Now += cycles;
+		}
+
+		uint64_t GetNextTime() const {
+			return (m_Size > 0) ? m_Heap[0].time : never;
+		}
+
+		bool IsDue() const {
+			return m_Size > 0 && m_Heap[0].time <= m_Now;
+		}
+
+		// adds the event or moves it if it is already pending
+		void Schedule(Event event, uint64_t time) {
+			uint8_t position = m_Positions[Index(event)];
+
+			if (position == none) {
+				position = m_Size++;
+				m_Heap[position] = { time, event };
+				m_Positions[Index(event)] = position;
+				SiftUp(position);
+				return;
+			}
+
+			uint64_t old_time = m_Heap[position].time;
+			m_Heap[position].time = time;
+
+			if (time < old_time) SiftUp(position);
+			else SiftDown(position);
+		}
+
+		void Cancel(Event event) {
+			uint8_t position = m_Positions[Index(event)];
+			if (position == none) return;
+
+			RemoveAt(position);
+		}
+
+		// removes and returns the earliest event, only call this when IsDue()
+		Event Pop() {
+			Event event = m_Heap[0].event;
+			RemoveAt(0);
+			return event;
+		}
+
+	private:
+		struct Entry {
+			uint64_t time;
+			Event event;
+		};
+
+		static constexpr uint8_t none = 0xff;
+
+		static size_t Index(Event event) {
+			return static_cast<size_t>(event);
+		}
+
+		void RemoveAt(uint8_t position) {
+			m_Positions[Index(m_Heap[position].event)] = none;
+			m_Size--;
+
+			if (position == m_Size) return;
+
+			m_Heap[position] = m_Heap[m_Size];
+			m_Positions[Index(m_Heap[position].event)] = position;
+
+			SiftUp(position);
+			SiftDown(m_Positions[Index(m_Heap[position].event)]);
+		}
+
+		void Swap(uint8_t a, uint8_t b) {
+			std::swap(m_Heap[a], m_Heap[b]);
+			m_Positions[Index(m_Heap[a].event)] = a;
+			m_Positions[Index(m_Heap[b].event)] = b;
+		}
+
+		void SiftUp(uint8_t position) {
+			while (position > 0) {
+				uint8_t parent = (position - 1) / 2;
+				if (m_Heap[parent].time <= m_Heap[position].time) break;
+
+				Swap(parent, position);
+				position = parent;
+			}
+		}
+
+		void SiftDown(uint8_t position) {
+			while (true) {
+				uint8_t smallest = position;
+				uint8_t left = position * 2 + 1;
+				uint8_t right = position * 2 + 2;
+
+				if (left < m_Size && m_Heap[left].time < m_Heap[smallest].time) smallest = left;
+				if (right < m_Size && m_Heap[right].time < m_Heap[smallest].time) smallest = right;
+				if (smallest == position) break;
+
+				Swap(smallest, position);
+				position = smallest;
+			}
+		}
+
+	private:
+		uint64_t m_Now = 0;
+
+		std::array<Entry, static_cast<size_t>(Event::Count)> m_Heap {};
+		std::array<uint8_t, static_cast<size_t>(Event::Count)> m_Positions;
+		uint8_t m_Size = 0;
+	};
+}
+
+#endif
\ No newline at end of file
@@ -2,31 +2,37 @@
 #include "bus.hpp"
 using namespace pedals::timer;
 
-void Timer::Tick() {
-	m_Cycles++;
-
-	if ((m_Cycles % 256) == 0) {
-		m_DIV++;
-	}
+void Timer::Sync() {
+	uint64_t now = m_Bus->GetCycles();
 
 	if (m_TIMAenabled) {
-		uint32_t cycles_per_increment = 0;
-		switch (m_TAC & 0b11) {
-			case 0b00: cycles_per_increment = 1024; break;
-			case 0b01: cycles_per_increment = 16; break;
-			case 0b10: cycles_per_increment = 64; break;
-			case 0b11: cycles_per_increment = 256; break;
+		// the overflow event normally runs right when it comes up, but a register access can be first
+		for (uint64_t overflow = GetOverflowCycle(); overflow <= now; overflow = GetOverflowCycle()) {
+			m_TIMA = m_TMA;
+			m_Synced = overflow;
+			m_Bus->RequestInterrupt(pedals::bus::InterruptFlag::Timer);
 		}
 
-		if ((m_Cycles % cycles_per_increment) == 0) {
-			m_TIMA++;
+		uint32_t period = GetCyclesPerIncrement();
+		m_TIMA += static_cast<uint8_t>((GetDivider(now) / period) - (GetDivider(m_Synced) / period));
+	}
 
-			if (m_TIMA == 0x00) {
-				m_TIMA = m_TMA;
-				m_Bus->RequestInterrupt(pedals::bus::InterruptFlag::Timer);
-			}
-		}
+	m_Synced = now;
+}
+
+void Timer::Schedule() {
+	if (!m_TIMAenabled) {
+		m_Bus->CancelEvent(pedals::scheduler::Event::Timer);
+		return;
 	}
+
+	m_Bus->ScheduleEvent(pedals::scheduler::Event::Timer, GetOverflowCycle());
+}
+
+uint64_t Timer::GetOverflowCycle() const {
+	uint64_t period = GetCyclesPerIncrement();
+	uint64_t next_increment = (GetDivider(m_Synced) / period + 1) * period;
+	return m_DividerStart + next_increment + (0xff - m_TIMA) * period;
 }
 
 void Timer::SetTAC(uint8_t bits) {
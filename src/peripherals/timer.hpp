@@ -1,7 +1,10 @@
 #ifndef TIMER_HPP
 #define TIMER_HPP
 
+#include "io.hpp"
+
 #include <memory>
+#include <limits>
 #include <stdint.h>
 
 namespace pedals::bus {
@@ -11,17 +14,29 @@ namespace pedals::bus {
 namespace pedals::timer {
 	class Timer {
 	public:
-		void SetBus(std::shared_ptr<pedals::bus::Bus> bus) {
-			m_Bus = bus;
+		void SetBus(pedals::bus::Bus& bus) {
+			m_Bus = &bus;
+		}
+
+		void MapIO(pedals::bus::IOMap& io) {
+			io.MapSynced<&Timer::ReadDIV, &Timer::WriteDIV>(0xff04, *this);
+			io.MapSynced<&Timer::ReadTIMA, &Timer::WriteTIMA>(0xff05, *this);
+			io.MapSynced<&Timer::ReadTMA, &Timer::WriteTMA>(0xff06, *this);
+			io.MapSynced<&Timer::ReadTAC, &Timer::WriteTAC>(0xff07, *this);
 		}
 
-		void Tick();
+		// brings TIMA up to the bus' current cycle, also doing any overflow that has come up since
+		void Sync();
+
+		// puts the next TIMA overflow in the scheduler, if TIMA is running
+		void Schedule();
 
 		void SetTAC(uint8_t bits);
 		uint8_t GetTAC();
 
+		// the registers are read right after Sync()
 		uint8_t ReadDIV(uint16_t) {
-			return m_DIV;
+			return static_cast<uint8_t>((m_Synced - m_DividerStart) >> 8);
 		}
 
 		uint8_t ReadTIMA(uint16_t) {
@@ -37,8 +52,7 @@ namespace pedals::timer {
 		}
 
 		void WriteDIV(uint16_t, uint8_t) {
-			m_DIV = 0;
-			m_Cycles = 0;
+			m_DividerStart = m_Synced;
 		}
 
 		void WriteTIMA(uint16_t, uint8_t value) {
@@ -54,16 +68,37 @@ namespace pedals::timer {
 		}
 	
 	private:
-		uint8_t m_DIV = 0;
+		uint32_t GetCyclesPerIncrement() const {
+			switch (m_TAC & 0b11) {
+				case 0b00: return 1024;
+				case 0b01: return 16;
+				case 0b10: return 64;
+				default: return 256;
+			}
+		}
+
+		// the divider counts T-cycles since DIV was last written, TIMA goes up every time it
+		// reaches a multiple of the TAC period
+		uint64_t GetDivider(uint64_t cycle) const {
+			return cycle - m_DividerStart;
+		}
+
+		// the bus cycle TIMA wraps around at, counting from m_Synced
+		uint64_t GetOverflowCycle() const;
+
+	private:
 		uint8_t m_TIMA = 0;
 		uint8_t m_TMA = 0;
 		uint8_t m_TAC = 0;
 		
 		bool m_TIMAenabled = false;
 
-		size_t m_Cycles = 0;
+		// the bus cycle DIV was last reset at and the one TIMA is up to date for, nothing is
+		// ticked in between
+		uint64_t m_DividerStart = 0;
+		uint64_t m_Synced = 0;
 
-		std::shared_ptr<pedals::bus::Bus> m_Bus;
+		pedals::bus::Bus* m_Bus = nullptr;
 	};
 }
 
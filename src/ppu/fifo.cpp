@@ -0,0 +1,179 @@
+#include "ppu.hpp"
+
+#include <algorithm>
+using namespace pedals::ppu;
+
+// the pixel FIFO renderer, TickFIFO() runs every dot of mode 3 and pushes at most one pixel out. with
+// nothing in the way mode 3 takes 172 dots like the scanline renderer, SCX, the window and sprites
+// make it longer
+
+void PPU::StartFIFOLine() {
+	m_FIFO = {};
+	m_FIFO.sprite_fetching = -1;
+	m_FIFO.delay = 6;
+	m_FIFO.window_on_line = IsWindowOnLine();
+
+	// a window at WX < 7 starts off screen, the pixels left of the screen are thrown away instead of SCX's
+	int wx = static_cast<int>(m_WX) - 7;
+	if (m_FIFO.window_on_line && wx <= 0) {
+		m_FIFO.in_window = true;
+		m_FIFO.discard = static_cast<uint8_t>(-wx);
+	} else {
+		m_FIFO.discard = m_SCX % 8;
+	}
+}
+
+void PPU::TickFIFO() {
+	// the first tile is fetched twice, the first time only costs the time
+	if (m_FIFO.delay > 0) {
+		m_FIFO.delay--;
+		return;
+	}
+
+	// the window takes over at its left edge, the fetcher starts over on the window's tile map
+	bool window_starts = !m_FIFO.in_window && m_FIFO.window_on_line && m_FIFO.discard == 0
+		&& m_LCDC.GetFlag(registers::LCDControlBits::WindowEnable) && m_FIFO.x + 7 == m_WX;
+
+	if (window_starts) {
+		m_FIFO.in_window = true;
+		m_FIFO.background_size = 0;
+		m_FIFO.fetch_dots = 0;
+		m_FIFO.fetch_column = 0;
+		m_FIFO.fetched = false;
+		return;
+	}
+
+	// a sprite at this x holds the pixels until it is fetched, the one further left (then the one
+	// earlier in OAM) goes first
+	if (m_FIFO.sprite_fetching < 0 && m_FIFO.discard == 0 && m_LCDC.GetFlag(registers::LCDControlBits::ObjEnable)) {
+		for (size_t i = 0; i < m_SpriteCount; i++) {
+			if ((m_FIFO.sprites_fetched & (1 << i)) || m_Sprites[i].x > m_FIFO.x + 8) continue;
+
+			if (m_FIFO.sprite_fetching < 0 || m_Sprites[i].x < m_Sprites[m_FIFO.sprite_fetching].x) {
+				m_FIFO.sprite_fetching = static_cast<int8_t>(i);
+			}
+		}
+	}
+
+	if (m_FIFO.sprite_fetching >= 0) {
+		// the background fetcher finishes its tile first, the sprite fetch starts on its last dot
+		if (!m_FIFO.fetched) {
+			StepFetcher();
+			if (!m_FIFO.fetched) return;
+		}
+
+		if (++m_FIFO.sprite_dots < 6) return;
+
+		FetchSprite(m_Sprites[m_FIFO.sprite_fetching]);
+		m_FIFO.sprites_fetched |= 1 << m_FIFO.sprite_fetching;
+		m_FIFO.sprite_fetching = -1;
+		m_FIFO.sprite_dots = 0;
+		return;
+	}
+
+	StepFetcher();
+
+	if (m_FIFO.background_size == 0) return;
+	uint8_t color = m_FIFO.background[8 - m_FIFO.background_size--];
+
+	if (m_FIFO.discard > 0) {
+		m_FIFO.discard--;
+		return;
+	}
+
+	OutputFIFOPixel(color);
+
+	if (m_FIFO.x == WIDTH && m_FIFO.in_window) {
+		m_WindowLine++;
+	}
+}
+
+void PPU::StepFetcher() {
+	if (!m_FIFO.fetched) {
+		m_FIFO.fetch_dots++;
+
+		// the registers are read when the fetcher gets to them, so writes in the middle of the line show up
+		uint8_t bg_y = static_cast<uint8_t>(m_SCY + m_LY);
+
+		if (m_FIFO.fetch_dots == 2) {
+			uint16_t map_address;
+			if (m_FIFO.in_window) {
+				uint16_t map_base = m_LCDC.GetFlag(registers::LCDControlBits::WindowTileMapArea) ? 0x9c00 : 0x9800;
+				map_address = map_base + (m_WindowLine / 8) * 32 + (m_FIFO.fetch_column & 31);
+			} else {
+				uint16_t map_base = m_LCDC.GetFlag(registers::LCDControlBits::BgTileMapArea) ? 0x9c00 : 0x9800;
+				map_address = map_base + (bg_y / 8) * 32 + ((m_SCX / 8 + m_FIFO.fetch_column) & 31);
+			}
+
+			m_FIFO.tile = ReadVRAM(map_address);
+		}
+
+		else if (m_FIFO.fetch_dots == 6) {
+			uint8_t row = m_FIFO.in_window ? (m_WindowLine % 8) : (bg_y % 8);
+			bool unsigned_tiles = m_LCDC.GetFlag(registers::LCDControlBits::BgWindowTileDataArea);
+			size_t tile = unsigned_tiles ? m_FIFO.tile : 256 + static_cast<int8_t>(m_FIFO.tile);
+
+			std::copy_n(GetTileRow(tile, row, false), 8, m_FIFO.row.begin());
+			m_FIFO.fetched = true;
+		}
+	}
+
+	// a tile only goes in once the FIFO has run empty
+	if (m_FIFO.fetched && m_FIFO.background_size == 0) {
+		m_FIFO.background = m_FIFO.row;
+		m_FIFO.background_size = 8;
+		m_FIFO.fetched = false;
+		m_FIFO.fetch_dots = 0;
+		m_FIFO.fetch_column++;
+	}
+}
+
+void PPU::FetchSprite(const Sprite& sprite) {
+	int sprite_height = m_LCDC.GetFlag(registers::LCDControlBits::ObjSize) ? 16 : 8;
+
+	uint8_t sprite_y = sprite.y - 16;
+	int line_y = m_LY - sprite_y;
+
+	// OBJ size was changed since the OAM scan
+	if (line_y >= sprite_height) return;
+
+	if (sprite.flags & SpriteFlags::YFlip) {
+		line_y = sprite_height - 1 - line_y;
+	}
+
+	int tile_index = sprite.tile_index;
+	if (sprite_height == 16) tile_index &= 0xfe;
+
+	const uint8_t* row = GetTileRow(tile_index + (line_y >> 3), line_y & 7, sprite.flags & SpriteFlags::XFlip);
+
+	// a sprite partly off the left edge is fetched at x = 0, the pixels it would have had before that are gone
+	int skipped = m_FIFO.x + 8 - sprite.x;
+
+	for (int i = skipped; i < 8; i++) {
+		// a sprite that was fetched earlier keeps its opaque pixels
+		SpritePixel& slot = m_FIFO.sprites[i - skipped];
+		if (slot.color == 0 && row[i] != 0) {
+			slot = { row[i], sprite.flags };
+		}
+	}
+}
+
+void PPU::OutputFIFOPixel(uint8_t color) {
+	SpritePixel sprite = m_FIFO.sprites[0];
+	std::copy(m_FIFO.sprites.begin() + 1, m_FIFO.sprites.end(), m_FIFO.sprites.begin());
+	m_FIFO.sprites[7] = {};
+
+	uint8_t shade = 0;
+	if (m_LCDC.GetFlag(registers::LCDControlBits::BgWindowEnable)) {
+		shade = m_BGP[color];
+	} else {
+		color = 0;
+	}
+
+	bool sprite_visible = sprite.color != 0 && m_LCDC.GetFlag(registers::LCDControlBits::ObjEnable);
+	if (sprite_visible && !((sprite.flags & SpriteFlags::Priority) && color != 0)) {
+		shade = (sprite.flags & SpriteFlags::Palette) ? m_OBP1[sprite.color] : m_OBP0[sprite.color];
+	}
+
+	m_Frame[m_LY * WIDTH + m_FIFO.x++] = shade;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef PIXEL_SINK_HPP
+#define PIXEL_SINK_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+namespace pedals::ppu {
+	// where the PPU puts finished lines as 32 bit colors, straight into memory the frontend owns (a
+	// locked SDL streaming texture for example). like the IO map it is a context pointer and a plain
+	// function pointer, so the PPU does not need to know anything about the frontend
+	class PixelSink {
+	public:
+		// owner.GetLine(y) returns where the WIDTH pixels of line `y` go (nullptr drops the line), the
+		// frontend decides when that memory is handed on, the PPU never tells it a line is done
+		template <auto get_line, typename T>
+		void Bind(T& owner) {
+			m_Context = &owner;
+
+			m_GetLine = [](void* context, size_t y) -> uint32_t* {
+				return (static_cast<T*>(context)->*get_line)(y);
+			};
+		}
+
+		// the colors of the 4 shades, in whatever pixel format the buffer is in
+		void SetColors(const std::array<uint32_t, 4>& colors) {
+			m_Colors = colors;
+		}
+
+		const std::array<uint32_t, 4>& GetColors() const {
+			return m_Colors;
+		}
+
+		uint32_t* GetLine(size_t y) const {
+			return m_GetLine(m_Context, y);
+		}
+
+	private:
+		void* m_Context = nullptr;
+		uint32_t* (*m_GetLine)(void*, size_t) = nullptr;
+
+		std::array<uint32_t, 4> m_Colors {};
+	};
+}
+
+#endif
\ No newline at end of file
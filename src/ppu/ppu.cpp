@@ -1,4 +1,5 @@
 #include "ppu.hpp"
+#include "tile_decoder.hpp"
 #include "../peripherals/bus.hpp"
 
 #include <algorithm>
@@ -7,48 +8,38 @@ using namespace pedals::ppu;
 void PPU::Tick() {
 	switch (m_Mode) {
 		case 2: {
-			if (m_Dots == 0) {
-				m_Sprites.clear();
-			}
-
-			if (m_Dots < 80 && m_Dots % 2 == 0) {
-				size_t sprite_index = m_Dots / 2;
-				
-				if (sprite_index < 40) {
-					size_t oam_index = sprite_index * 4;
-
-					uint8_t y = m_OAM[oam_index];
-					uint8_t x = m_OAM[oam_index + 1];
-					uint8_t tile = m_OAM[oam_index + 2];
-					SpriteFlags flags = static_cast<SpriteFlags>(m_OAM[oam_index + 3]);
-
-					int sprite_height = m_LCDC.GetFlag(registers::LCDControlBits::ObjSize) ? 16 : 8;
-					uint8_t sprite_y = y - 16;
-
-					if (m_LY >= sprite_y && m_LY < sprite_y + sprite_height && m_Sprites.size() < 10) {
-						m_Sprites.emplace_back(y, x, tile, flags, sprite_index);
-					}
-				}
-			}
-
+			// nothing blocks the CPU from OAM here, so the scan is done at the end of mode 2 to
+			// pick up writes made during it
 			if (m_Dots == 80) {
+				ScanOAM();
 				m_Mode = 3;
+				UpdateStatus();
+
+				if (m_Renderer == Renderer::FIFO) {
+					StartFIFOLine();
+				} else {
+					ComputeMode3Penalty();
+				}
 			}
 
 			break;
 		}
 
 		case 3: {
+			// mode 3 ends on the dot after the last pixel went out
+			if (m_Renderer == Renderer::FIFO) {
+				if (m_FIFO.x < WIDTH) TickFIFO();
+				else EnterHBlank();
+
+				break;
+			}
+
 			if (m_Dots == 81) {
 				RenderScanline();
 			}
 
 			else if (m_Dots == (80 + 172 + m_Mode3Penalty)) {
-				m_Mode = 0;
-
-				if (m_STAT.GetFlag(registers::LCDStatusBits::Mode0IntSelect)) {
-					m_Bus->RequestInterrupt(pedals::bus::InterruptFlag::LCD);
-				}
+				EnterHBlank();
 			}
 
 			break;
@@ -77,6 +68,8 @@ void PPU::Tick() {
 						m_Bus->RequestInterrupt(pedals::bus::InterruptFlag::LCD);
 					}
 				}
+
+				UpdateStatus();
 			}
 
 			break;
@@ -92,12 +85,223 @@ void PPU::Tick() {
 					m_Mode = 2;
 					m_WindowLineResetPending = true;
 				}
+
+				UpdateStatus();
 			}
 
 			break;
 		}
 	}
 
+	m_Dots++;
+}
+
+uint32_t PPU::CyclesUntilNextEvent() const {
+	switch (m_Mode) {
+		case 2: return (m_Dots < 80) ? 80 - m_Dots : 0;
+
+		case 3: {
+			// the FIFO renderer has something to do on every dot
+			if (m_Renderer == Renderer::FIFO) return 0;
+
+			int mode0_dot = static_cast<int>(80 + 172 + m_Mode3Penalty);
+			if (m_Dots <= 81) return 81 - m_Dots;
+			if (m_Dots < mode0_dot) return mode0_dot - m_Dots;
+			return 0;
+		}
+
+		default: {
+			return (m_Dots < 456) ? 456 - m_Dots : 0;
+		}
+	}
+}
+
+void PPU::Tick(uint32_t dots) {
+	while (dots > 0) {
+		uint32_t idle = std::min(dots, CyclesUntilNextEvent());
+		if (idle > 0) {
+			Skip(idle);
+			m_Synced += idle;
+			dots -= idle;
+			continue;
+		}
+
+		Tick();
+		m_Synced++;
+		dots--;
+	}
+}
+
+void PPU::Sync() {
+	// the PPU event is never more than a frame away, so the gap always fits
+	uint64_t now = m_Bus->GetCycles();
+	Tick(static_cast<uint32_t>(now - m_Synced));
+}
+
+void PPU::Schedule() {
+	m_Bus->ScheduleEvent(pedals::scheduler::Event::PPU, m_Synced + DotsUntilInterrupt() + 1);
+}
+
+uint32_t PPU::DotsUntilInterrupt() const {
+	// the line end is the Tick() at dot 456, a line is 457 dots from one of those to the next
+	uint32_t line_end = (m_Dots < 456) ? 456 - m_Dots : 0;
+
+	// the length of mode 3 is only known once it starts, until then (and all along with the FIFO renderer)
+	// the shortest one is used, if the event comes too early it is just booked again
+	constexpr uint32_t mode0_dot = 80 + 172;
+
+	// the line end that makes LY == ly, counting the one of this line as the first
+	auto line_ends_until = [this](uint32_t ly) -> uint32_t {
+		return (ly + 154 - m_LY - 1) % 154 + 1;
+	};
+
+	auto dots_until_line_end = [line_end](uint32_t count) -> uint32_t {
+		return line_end + (count - 1) * 457;
+	};
+
+	// VBlank is always requested, it is also where the frame is finished
+	uint32_t dots = dots_until_line_end(line_ends_until(144));
+
+	if (m_STAT.GetFlag(registers::LCDStatusBits::LycIntSelect) && m_LYC < 154) {
+		dots = std::min(dots, dots_until_line_end(line_ends_until(m_LYC)));
+	}
+
+	// mode 2 is only requested coming from HBlank, not when VBlank ends
+	if (m_STAT.GetFlag(registers::LCDStatusBits::Mode2IntSelect)) {
+		uint32_t count = (m_LY < 143) ? 1 : line_ends_until(1);
+		dots = std::min(dots, dots_until_line_end(count));
+	}
+
+	if (m_STAT.GetFlag(registers::LCDStatusBits::Mode0IntSelect)) {
+		if (m_LY < 144 && (m_Mode == 2 || m_Mode == 3)) {
+			dots = std::min(dots, DotsUntilHBlank());
+		} else {
+			uint32_t count = (m_LY < 143) ? 1 : line_ends_until(0);
+			dots = std::min(dots, dots_until_line_end(count) + 1 + mode0_dot);
+		}
+	}
+
+	return dots;
+}
+
+uint32_t PPU::DotsUntilHBlank() const {
+	if (m_Renderer == Renderer::FIFO && m_Mode == 3) {
+		return WIDTH - m_FIFO.x;
+	}
+
+	return static_cast<uint32_t>(80 + 172 + m_Mode3Penalty - m_Dots);
+}
+
+void PPU::EnterHBlank() {
+	// the line is done, the frontend gets it while it is still in the cache
+	if (m_Sink) OutputLine(m_LY);
+
+	m_Mode = 0;
+	m_Mode3Penalty = 0;
+	UpdateStatus();
+
+	if (m_STAT.GetFlag(registers::LCDStatusBits::Mode0IntSelect)) {
+		m_Bus->RequestInterrupt(pedals::bus::InterruptFlag::LCD);
+	}
+}
+
+void PPU::OutputLine(size_t y) {
+	uint32_t* pixels = m_Sink->GetLine(y);
+	if (!pixels) return;
+
+	const std::array<uint32_t, 4>& colors = m_Sink->GetColors();
+	const uint8_t* line = &m_Frame[y * WIDTH];
+
+	for (size_t x = 0; x < WIDTH; x++) {
+		pixels[x] = colors[line[x] & 0b11];
+	}
+}
+
+void PPU::OutputFrame() {
+	if (!m_Sink) return;
+
+	for (size_t y = 0; y < HEIGHT; y++) {
+		OutputLine(y);
+	}
+}
+
+void PPU::Skip(uint32_t dots) {
+	m_Dots += dots;
+}
+
+void PPU::ScanOAM() {
+	m_SpriteCount = 0;
+
+	int sprite_height = m_LCDC.GetFlag(registers::LCDControlBits::ObjSize) ? 16 : 8;
+
+	for (size_t sprite_index = 0; sprite_index < 40 && m_SpriteCount < m_Sprites.size(); sprite_index++) {
+		size_t oam_index = sprite_index * 4;
+
+		uint8_t y = m_OAM[oam_index];
+		uint8_t x = m_OAM[oam_index + 1];
+		uint8_t tile = m_OAM[oam_index + 2];
+		SpriteFlags flags = static_cast<SpriteFlags>(m_OAM[oam_index + 3]);
+
+		uint8_t sprite_y = y - 16;
+
+		if (m_LY >= sprite_y && m_LY < sprite_y + sprite_height) {
+			m_Sprites[m_SpriteCount++] = { y, x, tile, flags, sprite_index };
+		}
+	}
+}
+
+void PPU::ComputeMode3Penalty() {
+	int wx = static_cast<int>(m_WX) - 7;
+	bool window_on_line = IsWindowOnLine();
+
+	// the first SCX % 8 pixels are fetched and thrown away, or the ones left of the screen if the window
+	// starts there. otherwise the fetcher starts over when it gets to the window
+	if (window_on_line && wx <= 0) {
+		m_Mode3Penalty = -wx;
+	} else {
+		m_Mode3Penalty = m_SCX % 8;
+		if (window_on_line) m_Mode3Penalty += 6;
+	}
+
+	if (!m_LCDC.GetFlag(registers::LCDControlBits::ObjEnable)) return;
+
+	// every sprite stops the pixels for 6 dots, the first one on a background or window tile also
+	// waits for the fetcher to finish the next tile, 6 dots minus the pixels of the tile that are
+	// already out. on a tile's first pixel the next tile is only still being fetched when the fetcher
+	// has just started (the first tile of the line or of the window). the window's tiles come after
+	// the background's
+	std::array<int, 64> first_offset;
+	first_offset.fill(8);
+
+	for (size_t i = 0; i < m_SpriteCount; i++) {
+		int x = static_cast<int>(m_Sprites[i].x) - 8;
+		if (x >= WIDTH) continue;
+
+		// a sprite partly off the left edge is fetched at x = 0
+		x = std::max(x, 0);
+		m_Mode3Penalty += 6;
+
+		int tile, offset;
+		if (window_on_line && x >= wx) {
+			tile = 32 + (x - wx) / 8;
+			offset = (x - wx) % 8;
+		} else {
+			tile = (x + m_SCX % 8) / 8;
+			offset = (x + m_SCX) % 8;
+		}
+
+		bool fetcher_started = (tile == 0 || tile == 32);
+		if (offset == 0 && !fetcher_started) continue;
+
+		first_offset[tile] = std::min(first_offset[tile], offset);
+	}
+
+	for (int offset : first_offset) {
+		if (offset < 8) m_Mode3Penalty += std::max(0, 6 - offset);
+	}
+}
+
+void PPU::UpdateStatus() {
 	// if LYC == LY then set the bit and request an interrupt
 	if (m_LYC == m_LY && !m_DontCheckLYC) {
 		m_STAT.SetWithoutMask(m_STAT.Get() | 0b00000100);
@@ -117,8 +321,6 @@ void PPU::Tick() {
 
 	// PPU mode
 	m_STAT.SetWithoutMask((m_STAT.Get() & 0b11111100) | (m_Mode & 0b00000011));
-
-	m_Dots++;
 }
 
 void PPU::DMATransferOAM(uint16_t, uint8_t value) {
@@ -127,13 +329,26 @@ void PPU::DMATransferOAM(uint16_t, uint8_t value) {
 	}
 }
 
-void PPU::RenderScanline() {
-	if (m_LY >= 144) return;
+void PPU::DecodeTile(size_t tile) {
+	DecodedTile& decoded = m_Tiles[tile];
+	decode_tile_rows(&m_VideoRAM[tile * 16], decoded.rows[0].data(), decoded.flipped[0].data(), 8);
 
-	uint8_t bg_y = static_cast<uint8_t>((m_SCY + m_LY) & 0xff);
-	uint8_t bg_tile_row = bg_y / 8;
-	uint8_t bg_pixel_y = bg_y % 8;
+	m_TileDirty[tile] = false;
+}
+
+void PPU::FetchTileRows(uint16_t map_row, uint8_t first_column, uint8_t row, int count, uint8_t* out) {
+	// 0x8000 counts tile numbers up from tile 0, 0x9000 counts them signed from tile 256
+	bool unsigned_tiles = m_LCDC.GetFlag(registers::LCDControlBits::BgWindowTileDataArea);
+
+	for (int i = 0; i < count; i++) {
+		uint8_t tile_index = m_VideoRAM[map_row - 0x8000 + ((first_column + i) & 31)];
+		size_t tile = unsigned_tiles ? tile_index : 256 + static_cast<int8_t>(tile_index);
+
+		std::copy_n(GetTileRow(tile, row, false), 8, out + i * 8);
+	}
+}
 
+bool PPU::IsWindowOnLine() {
 	int wx = static_cast<int>(m_WX) - 7;
 	bool window_enabled = m_LCDC.GetFlag(registers::LCDControlBits::WindowEnable);
 	bool window_visible_this_line = window_enabled && (wx < WIDTH) && (m_LY >= m_WY);
@@ -143,107 +358,104 @@ void PPU::RenderScanline() {
 		m_WindowLineResetPending = false;
 	}
 
-	for (int x = 0; x < WIDTH; ++x) {
-		uint8_t bg_window_color = 0;
+	return window_visible_this_line;
+}
 
-		if (m_LCDC.GetFlag(registers::LCDControlBits::BgWindowEnable)) {
-			// window pixel
-			if (window_visible_this_line && x >= wx && false) {
-				int window_x = x - wx;
-				uint8_t window_tile_row = m_WindowLine / 8;
-				uint8_t window_pixel_y = m_WindowLine % 8;
+void PPU::RenderScanline() {
+	if (m_LY >= 144) return;
 
-				int tile_col = window_x / 8;
-				int pixel_x = window_x % 8;
+	int wx = static_cast<int>(m_WX) - 7;
+	bool window_visible_this_line = IsWindowOnLine();
 
-				uint16_t map_base = m_LCDC.GetFlag(registers::LCDControlBits::WindowTileMapArea) ? 0x9c00 : 0x9800;
-				uint16_t map_addr = static_cast<uint16_t>(map_base + window_tile_row * 32 + tile_col);
-				uint8_t tile_index = ReadVRAM(map_addr);
+	// the sprites are drawn over the whole line afterwards, their priority bit needs these
+	std::array<uint8_t, WIDTH> bg_colors {};
+	uint8_t* line = &m_Frame[m_LY * WIDTH];
 
-				uint16_t data_base = m_LCDC.GetFlag(registers::LCDControlBits::BgWindowTileDataArea) ? 0x8000 : 0x9000;
-				int tile_number = (data_base == 0x9000) ? static_cast<int8_t>(tile_index) : tile_index;
-				uint16_t tile_addr = static_cast<uint16_t>(data_base + tile_number * 16);
+	if (m_LCDC.GetFlag(registers::LCDControlBits::BgWindowEnable)) {
+		// 21 tiles cover the line for any fine scroll, the first SCX % 8 pixels are left out
+		std::array<uint8_t, 21 * 8> fetched;
 
-				uint8_t low_byte  = ReadVRAM(tile_addr + window_pixel_y * 2);
-				uint8_t high_byte = ReadVRAM(tile_addr + window_pixel_y * 2 + 1);
+		uint8_t bg_y = static_cast<uint8_t>(m_SCY + m_LY);
+		uint16_t bg_map = m_LCDC.GetFlag(registers::LCDControlBits::BgTileMapArea) ? 0x9c00 : 0x9800;
 
-				int bit_index = 7 - pixel_x;
-				bg_window_color = static_cast<uint8_t>(((high_byte >> bit_index) & 1) << 1 | ((low_byte >> bit_index) & 1));
-			}
+		FetchTileRows(bg_map + (bg_y / 8) * 32, m_SCX / 8, bg_y % 8, 21, fetched.data());
+		std::copy_n(fetched.begin() + (m_SCX % 8), WIDTH, bg_colors.begin());
 
-			// background pixel
-			else {
-				int bg_x = (m_SCX + x) & 0xff;
-				int tile_col = bg_x / 8;
-				int pixel_x = bg_x % 8;
+		// the window covers everything from its left edge on, which can be up to 7 pixels off screen
+		if (window_visible_this_line) {
+			int first_x = std::max(wx, 0);
+			int tiles = (WIDTH - wx + 7) / 8;
+			uint16_t window_map = m_LCDC.GetFlag(registers::LCDControlBits::WindowTileMapArea) ? 0x9c00 : 0x9800;
 
-				uint16_t map_base = m_LCDC.GetFlag(registers::LCDControlBits::BgTileMapArea) ? 0x9c00 : 0x9800;
-				uint16_t map_addr = static_cast<uint16_t>(map_base + bg_tile_row * 32 + tile_col);
-				uint8_t tile_index = ReadVRAM(map_addr);
+			FetchTileRows(window_map + (m_WindowLine / 8) * 32, 0, m_WindowLine % 8, tiles, fetched.data());
+			std::copy_n(fetched.begin() + (first_x - wx), WIDTH - first_x, bg_colors.begin() + first_x);
+		}
 
-				uint16_t data_base = m_LCDC.GetFlag(registers::LCDControlBits::BgWindowTileDataArea) ? 0x8000 : 0x9000;
-				int tile_number = (data_base == 0x9000) ? static_cast<int8_t>(tile_index) : tile_index;
-				uint16_t tile_addr = static_cast<uint16_t>(data_base + tile_number * 16);
+		map_palette(bg_colors.data(), line, WIDTH, m_BGP);
+	} else {
+		std::fill_n(line, WIDTH, 0);
+	}
 
-				uint8_t low_byte = ReadVRAM(tile_addr + bg_pixel_y * 2);
-				uint8_t high_byte = ReadVRAM(tile_addr + bg_pixel_y * 2 + 1);
+	if (m_LCDC.GetFlag(registers::LCDControlBits::ObjEnable)) {
+		RenderSprites(bg_colors);
+	}
 
-				int bit_index = 7 - pixel_x;
-				bg_window_color = static_cast<uint8_t>(((high_byte >> bit_index) & 1) << 1 | ((low_byte >> bit_index) & 1));
-			}
+	if (window_visible_this_line) {
+		m_WindowLine++;
+	}
+}
 
-			m_Frame[m_LY * WIDTH + x] = m_BGP[bg_window_color];
+void PPU::RenderSprites(const std::array<uint8_t, WIDTH>& bg_colors) {
+	uint8_t* line = &m_Frame[m_LY * WIDTH];
+	int sprite_height = m_LCDC.GetFlag(registers::LCDControlBits::ObjSize) ? 16 : 8;
+
+	// DMG priority, the sprite further to the left wins and on a tie the one earlier in OAM. the
+	// sprites are in OAM order already so a stable sort on x is enough
+	std::array<uint8_t, 10> order;
+	for (size_t i = 0; i < m_SpriteCount; i++) {
+		size_t j = i;
+		while (j > 0 && m_Sprites[order[j - 1]].x > m_Sprites[i].x) {
+			order[j] = order[j - 1];
+			j--;
 		}
 
-		else {
-			m_Frame[m_LY * WIDTH + x] = 0;
-		}
+		order[j] = static_cast<uint8_t>(i);
+	}
 
-		// sprites
-		if (m_LCDC.GetFlag(registers::LCDControlBits::ObjEnable)) {
-			for (int si = static_cast<int>(m_Sprites.size()) - 1; si >= 0; --si) {
-				const Sprite& sprite = m_Sprites[si];
-				uint8_t sprite_x = sprite.x - 8;
-				uint8_t sprite_y = sprite.y - 16;
-				uint8_t sprite_height = m_LCDC.GetFlag(registers::LCDControlBits::ObjSize) ? 16 : 8;
+	// the first opaque sprite pixel takes the pixel, even if it is behind the background in the end
+	std::array<bool, WIDTH> taken {};
 
-				if (m_LY >= sprite_y && m_LY < sprite_y + sprite_height && x >= sprite_x && x < sprite_x + 8) {
-					int pixel_x = x - sprite_x;
-					int line_y = m_LY - sprite_y;
+	for (size_t i = 0; i < m_SpriteCount; i++) {
+		const Sprite& sprite = m_Sprites[order[i]];
 
-					if (sprite.flags & SpriteFlags::YFlip) {
-						line_y = sprite_height - 1 - line_y;
-					}
+		uint8_t sprite_y = sprite.y - 16;
+		int line_y = m_LY - sprite_y;
 
-					int tile_index = sprite.tile_index;
-					if (sprite_height == 16) tile_index &= 0xfe;
+		if (sprite.flags & SpriteFlags::YFlip) {
+			line_y = sprite_height - 1 - line_y;
+		}
 
-					uint16_t tile_addr = static_cast<uint16_t>(0x8000 + tile_index * 16);
-					if (line_y >= 8) {
-						tile_addr += 16;
-						line_y -= 8;
-					}
+		int tile_index = sprite.tile_index;
+		if (sprite_height == 16) tile_index &= 0xfe;
 
-					if (sprite.flags & SpriteFlags::XFlip) pixel_x = 7 - pixel_x;
+		// 8x16 sprites are two tiles after each other, the row runs into the second one
+		const uint8_t* row = GetTileRow(tile_index + (line_y >> 3), line_y & 7, sprite.flags & SpriteFlags::XFlip);
 
-					uint8_t low_byte  = ReadVRAM(tile_addr + line_y * 2);
-					uint8_t high_byte = ReadVRAM(tile_addr + line_y * 2 + 1);
+		const std::array<uint8_t, 4>& palette = (sprite.flags & SpriteFlags::Palette) ? m_OBP1 : m_OBP0;
+		int sprite_x = static_cast<int>(sprite.x) - 8;
 
-					int bit_index = 7 - pixel_x;
-					uint8_t sprite_color_index = static_cast<uint8_t>(((high_byte >> bit_index) & 1) << 1 | ((low_byte >> bit_index) & 1));
+		for (int pixel_x = 0; pixel_x < 8; pixel_x++) {
+			int x = sprite_x + pixel_x;
+			if (x < 0 || x >= WIDTH || taken[x]) continue;
 
-					if (sprite_color_index != 0) {
-						uint8_t color = (sprite.flags & SpriteFlags::Palette) ? m_OBP1[sprite_color_index] : m_OBP0[sprite_color_index];
-						if (!((sprite.flags & SpriteFlags::Priority) && bg_window_color != 0)) {
-							m_Frame[m_LY * WIDTH + x] = color;
-						}
-					}
-				}
+			uint8_t color_index = row[pixel_x];
+			if (color_index == 0) continue;
+
+			taken[x] = true;
+
+			if (!((sprite.flags & SpriteFlags::Priority) && bg_colors[x] != 0)) {
+				line[x] = palette[color_index];
 			}
 		}
 	}
-
-	if (window_visible_this_line) {
-		m_WindowLine++;
-	}
 }
\ No newline at end of file
@@ -4,7 +4,11 @@
 #define WIDTH 160
 #define HEIGHT 144
 
+#include "../peripherals/io.hpp"
+#include "pixel_sink.hpp"
+
 #include <array>
+#include <algorithm>
 #include <vector>
 #include <memory>
 
@@ -58,7 +62,7 @@ namespace pedals::ppu::registers {
 			Set(m_Bits & ~bit);
 		}
 
-		bool GetFlag(T bit) {
+		bool GetFlag(T bit) const {
 			return m_Bits & bit;
 		}
 
@@ -89,12 +93,53 @@ namespace pedals::ppu {
 		size_t oam_index;
 	};
 
+	// how mode 3 is drawn, the scanline renderer draws the whole line at once and the FIFO renderer
+	// runs the DMG pixel FIFO dot by dot, which gets mid-line register writes and the length of mode 3 right
+	enum class Renderer : uint8_t {
+		Scanline,
+		FIFO,
+	};
+
 	class PPU {
 	public:
-		PPU() : m_VideoRAM(0x2000, 0), m_OAM(0xa0, 0), m_Frame(WIDTH * HEIGHT, 0) {}
+		PPU() : m_VideoRAM(0x2000, 0), m_OAM(0xa0, 0), m_Frame(WIDTH * HEIGHT, 0), m_Tiles(384) {
+			m_TileDirty.fill(true);
+		}
 		
-		void SetBus(std::shared_ptr<pedals::bus::Bus> bus) {
-			m_Bus = bus;
+		// has to be picked before the bus is set, the scanline renderer is the default
+		void SetRenderer(Renderer renderer) {
+			m_Renderer = renderer;
+		}
+
+		Renderer GetRenderer() const {
+			return m_Renderer;
+		}
+
+		// every line is written into the sink as soon as it is drawn, nullptr leaves GetFrame() as the only output
+		void SetPixelSink(const PixelSink* sink) {
+			m_Sink = sink;
+		}
+
+		// this also sets up STAT for the first line and schedules the first PPU event
+		void SetBus(pedals::bus::Bus& bus) {
+			m_Bus = &bus;
+			UpdateStatus();
+			Schedule();
+		}
+
+		void MapIO(pedals::bus::IOMap& io) {
+			io.MapSynced<&PPU::ReadLCDC, &PPU::WriteLCDC>(0xff40, *this);
+			io.MapSynced<&PPU::ReadSTAT, &PPU::WriteSTAT>(0xff41, *this);
+			io.MapSynced<&PPU::ReadSCY, &PPU::WriteSCY>(0xff42, *this);
+			io.MapSynced<&PPU::ReadSCX, &PPU::WriteSCX>(0xff43, *this);
+			io.MapSyncedRead<&PPU::ReadLY>(0xff44, *this);
+			io.MapSynced<&PPU::ReadLYC, &PPU::WriteLYC>(0xff45, *this);
+			io.MapSyncedWrite<&PPU::DMATransferOAM>(0xff46, *this);
+			io.MapSynced<&PPU::ReadBGP, &PPU::WriteBGP>(0xff47, *this);
+			io.MapSynced<&PPU::ReadOBP0, &PPU::WriteOBP0>(0xff48, *this);
+			io.MapSynced<&PPU::ReadOBP1, &PPU::WriteOBP1>(0xff49, *this);
+			io.MapSynced<&PPU::ReadWY, &PPU::WriteWY>(0xff4a, *this);
+			io.MapSynced<&PPU::ReadWX, &PPU::WriteWX>(0xff4b, *this);
 		}
 
 		bool ShouldRender() {
@@ -106,6 +151,10 @@ namespace pedals::ppu {
 			return true;
 		}
 
+		// writes the whole frame into the sink again, for when the frontend needs lines that were drawn
+		// before it last handed its buffer on
+		void OutputFrame();
+
 		const std::vector<uint8_t>& GetFrame() {
 			return m_Frame;
 		}
@@ -118,7 +167,23 @@ namespace pedals::ppu {
 			return m_STAT;
 		}
 		
-		void Tick();
+		// runs `dots` dots, jumping straight from one dot that does something to the next
+		void Tick(uint32_t dots);
+
+		// runs the dots up to the bus' current cycle, the PPU only gets synced when its event
+		// comes up or when its registers are accessed
+		void Sync();
+
+		// puts the next dot that can request an interrupt in the scheduler, rendering does not
+		// need an event since everything it reads syncs the PPU before it changes
+		void Schedule();
+
+		// brings the PPU up to now and returns how many dots it stays idle for, none of its registers
+		// change and VRAM can be written ahead of time for that long without the PPU noticing
+		uint32_t CyclesUntilActive() {
+			Sync();
+			return CyclesUntilNextEvent();
+		}
 
 	public:
 		std::array<uint8_t, 4>& GetBGPRef() {
@@ -133,6 +198,14 @@ namespace pedals::ppu {
 			return m_OBP1;
 		}
 	public:
+		uint8_t ReadLCDC(uint16_t address) {
+			return m_LCDC.Read(address);
+		}
+
+		uint8_t ReadSTAT(uint16_t address) {
+			return m_STAT.Read(address);
+		}
+
 		uint8_t ReadVRAM(uint16_t address) {
 			return m_VideoRAM[address - 0x8000];
 		}
@@ -179,6 +252,14 @@ namespace pedals::ppu {
 		}
 
 	public:
+		void WriteLCDC(uint16_t address, uint8_t value) {
+			m_LCDC.Write(address, value);
+		}
+
+		void WriteSTAT(uint16_t address, uint8_t value) {
+			m_STAT.Write(address, value);
+		}
+
 		void WriteSCX(uint16_t, uint8_t value) {
 			m_SCX = value;
 		}
@@ -189,10 +270,27 @@ namespace pedals::ppu {
 
 		void WriteLYC(uint16_t, uint8_t value) {
 			m_LYC = value;
+			UpdateStatus();
 		}
 
 		void WriteVRAM(uint16_t address, uint8_t value) {
 			m_VideoRAM[address - 0x8000] = value;
+
+			// tile data is 0x8000-0x97ff, the tile maps after it are not cached
+			if (address < 0x9800) m_TileDirty[(address - 0x8000) >> 4] = true;
+		}
+
+		// for the bus to run copy loops on, anything written through this skips WriteVRAM() so
+		// InvalidateTiles() has to be called for it
+		std::vector<uint8_t>& GetVRAMRef() {
+			return m_VideoRAM;
+		}
+
+		void InvalidateTiles(uint16_t address, uint16_t count) {
+			uint32_t end = std::min<uint32_t>(address + count, 0x9800);
+			for (uint32_t tile_address = address & 0xfff0; tile_address < end; tile_address += 16) {
+				m_TileDirty[(tile_address - 0x8000) >> 4] = true;
+			}
 		}
 
 		void WriteOAM(uint16_t address, uint8_t value) {
@@ -237,15 +335,129 @@ namespace pedals::ppu {
 		void DMATransferOAM(uint16_t, uint8_t value);
 
 	private:
+		// a single dot
+		void Tick();
+
+		// how many dots can pass before Tick() does anything besides counting the dot
+		uint32_t CyclesUntilNextEvent() const;
+
+		// same as calling Tick() `dots` times, as long as it is not more than CyclesUntilNextEvent()
+		void Skip(uint32_t dots);
+
+		// how many dots until the next VBlank, STAT or LYC interrupt could be requested
+		uint32_t DotsUntilInterrupt() const;
+
+		// picks the (up to 10) sprites on this line all at once, real hardware spreads this over mode 2
+		void ScanOAM();
+
+		// the dots the scanline renderer adds to mode 3 for SCX, the window and this line's sprites,
+		// the same costs the FIFO renderer ends up with
+		void ComputeMode3Penalty();
+
+		// a row of 8 color indices from the tile cache, decoding the tile first if it was written to.
+		// `tile` counts from 0x8000 and `x_flip` gives the row mirrored for sprites
+		const uint8_t* GetTileRow(size_t tile, int row, bool x_flip) {
+			if (m_TileDirty[tile]) DecodeTile(tile);
+
+			const DecodedTile& decoded = m_Tiles[tile];
+			return x_flip ? decoded.flipped[row].data() : decoded.rows[row].data();
+		}
+
+		void DecodeTile(size_t tile);
+
+		// copies the rows of `count` tiles from one row of a tile map into `out`, starting at `first_column`
+		// and wrapping around like the background does
+		void FetchTileRows(uint16_t map_row, uint8_t first_column, uint8_t row, int count, uint8_t* out);
+
 		void RenderScanline();
+
+		// draws this line's sprites over the background, `bg_colors` are the color indices under them
+		void RenderSprites(const std::array<uint8_t, WIDTH>& bg_colors);
+
+		// LYC == LY and the mode bits in STAT, this only has to run when LY, LYC or the mode changes
+		void UpdateStatus();
+
+		void EnterHBlank();
+
+		// maps a drawn line through the sink's colors into its buffer
+		void OutputLine(size_t y);
+
+		// dots until mode 0 on this line, with the FIFO renderer this is only the least it could be
+		uint32_t DotsUntilHBlank() const;
+
+		// whether the window can show up on this line, the first line it does restarts its line counter
+		bool IsWindowOnLine();
+
+		// the FIFO renderer, in fifo.cpp
+		void StartFIFOLine();
+		void TickFIFO();
+		void StepFetcher();
+		void FetchSprite(const Sprite& sprite);
+		void OutputFIFOPixel(uint8_t color);
 	
 	private:
-		std::shared_ptr<pedals::bus::Bus> m_Bus;
+		pedals::bus::Bus* m_Bus = nullptr;
 
 		std::vector<uint8_t> m_VideoRAM;
 		std::vector<uint8_t> m_OAM;
 		std::vector<uint8_t> m_Frame;
-		std::vector<Sprite> m_Sprites;
+
+		// the 384 tiles of 0x8000-0x97ff as one color index per pixel, each tile is only decoded
+		// again after it has been written to
+		struct DecodedTile {
+			std::array<std::array<uint8_t, 8>, 8> rows;
+			std::array<std::array<uint8_t, 8>, 8> flipped;
+		};
+
+		std::vector<DecodedTile> m_Tiles;
+		std::array<bool, 384> m_TileDirty;
+
+		// the sprites ScanOAM() picked for this line, in OAM order
+		std::array<Sprite, 10> m_Sprites {};
+		size_t m_SpriteCount = 0;
+
+		Renderer m_Renderer = Renderer::Scanline;
+		const PixelSink* m_Sink = nullptr;
+
+		// a sprite pixel waiting to be mixed with the background, color 0 is an empty slot
+		struct SpritePixel {
+			uint8_t color;
+			SpriteFlags flags;
+		};
+
+		// the state of the FIFO renderer during mode 3
+		struct FIFO {
+			// the background FIFO is only ever refilled when it is empty, so it only needs a count
+			std::array<uint8_t, 8> background;
+			uint8_t background_size;
+
+			// slot 0 goes out with the next pixel
+			std::array<SpritePixel, 8> sprites;
+
+			// the fetcher takes 6 dots for a tile (map entry, low and high byte), then waits for the FIFO
+			uint8_t fetch_dots;
+			uint8_t fetch_column;
+			uint8_t tile;
+			bool fetched;
+			std::array<uint8_t, 8> row;
+
+			// the pixel that goes out next
+			uint8_t x;
+
+			// dots of the first fetch, which is thrown away, and pixels left out for SCX or WX < 7
+			uint8_t delay;
+			uint8_t discard;
+
+			bool window_on_line;
+			bool in_window;
+
+			// OAM fetches, one bit per entry of m_Sprites
+			uint16_t sprites_fetched;
+			int8_t sprite_fetching;
+			uint8_t sprite_dots;
+		};
+
+		FIFO m_FIFO {};
 
 		registers::LCDControlRegister m_LCDC;
 		registers::LCDStatusRegister m_STAT;
@@ -268,6 +480,9 @@ namespace pedals::ppu {
 		bool m_WindowLineResetPending = false;
 		
 		int m_Dots = 0;
+
+		// the bus cycle the PPU has run up to
+		uint64_t m_Synced = 0;
 		size_t m_Mode3Penalty = 0;
 
 		bool m_ShouldRender = false;
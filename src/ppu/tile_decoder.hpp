@@ -0,0 +1,143 @@
+#ifndef TILE_DECODER_HPP
+#define TILE_DECODER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// the pixel kernels of the scanline renderer, the vector paths are picked at compile time (AVX2
+// with -mavx2 or -march=native, SSE2 on any x86-64) and everything else gets the scalar loops
+namespace pedals::ppu {
+	// turns `rows` rows of 2bpp tile data (a low and a high bitplane byte each) into 8 color indices
+	// per row, `flipped` gets the same rows mirrored for x flipped sprites
+	inline void decode_tile_rows(const uint8_t* data, uint8_t* out, uint8_t* flipped, size_t rows) {
+		size_t row = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+		// every byte of a row gets the bitplane byte and picks out its own bit with the mask
+		constexpr uint64_t spread = 0x0101010101010101ull;
+		constexpr int64_t bits = 0x0102040810204080ll;
+		constexpr int64_t mirrored_bits = static_cast<int64_t>(0x8040201008040201ull);
+#endif
+
+#if defined(__AVX2__)
+		const __m256i mask = _mm256_set1_epi64x(bits);
+		const __m256i mirrored_mask = _mm256_set1_epi64x(mirrored_bits);
+		const __m256i one = _mm256_set1_epi8(1);
+		const __m256i two = _mm256_set1_epi8(2);
+
+		for (; row + 4 <= rows; row += 4) {
+			const uint8_t* bytes = data + row * 2;
+			__m256i low = _mm256_set_epi64x(bytes[6] * spread, bytes[4] * spread, bytes[2] * spread, bytes[0] * spread);
+			__m256i high = _mm256_set_epi64x(bytes[7] * spread, bytes[5] * spread, bytes[3] * spread, bytes[1] * spread);
+
+			__m256i pixels = _mm256_or_si256(
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(low, mask), mask), one),
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(high, mask), mask), two));
+
+			__m256i mirrored = _mm256_or_si256(
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(low, mirrored_mask), mirrored_mask), one),
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(high, mirrored_mask), mirrored_mask), two));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * 8), pixels);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(flipped + row * 8), mirrored);
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		const __m128i mask = _mm_set1_epi64x(bits);
+		const __m128i mirrored_mask = _mm_set1_epi64x(mirrored_bits);
+		const __m128i one = _mm_set1_epi8(1);
+		const __m128i two = _mm_set1_epi8(2);
+
+		for (; row + 2 <= rows; row += 2) {
+			const uint8_t* bytes = data + row * 2;
+			__m128i low = _mm_set_epi64x(bytes[2] * spread, bytes[0] * spread);
+			__m128i high = _mm_set_epi64x(bytes[3] * spread, bytes[1] * spread);
+
+			__m128i pixels = _mm_or_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low, mask), mask), one),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high, mask), mask), two));
+
+			__m128i mirrored = _mm_or_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low, mirrored_mask), mirrored_mask), one),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high, mirrored_mask), mirrored_mask), two));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * 8), pixels);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(flipped + row * 8), mirrored);
+		}
+#endif
+
+		for (; row < rows; row++) {
+			uint8_t low_byte = data[row * 2];
+			uint8_t high_byte = data[row * 2 + 1];
+
+			for (int x = 0; x < 8; x++) {
+				int bit_index = 7 - x;
+				uint8_t color_index = static_cast<uint8_t>(((high_byte >> bit_index) & 1) << 1 | ((low_byte >> bit_index) & 1));
+
+				out[row * 8 + x] = color_index;
+				flipped[row * 8 + 7 - x] = color_index;
+			}
+		}
+	}
+
+	// looks up `count` color indices in a BGP/OBP style palette
+	inline void map_palette(const uint8_t* indices, uint8_t* out, size_t count, const std::array<uint8_t, 4>& palette) {
+		size_t i = 0;
+
+#if defined(__AVX2__)
+		// a compare per palette entry selects its shade, there are only 4 of them
+		const __m256i shade0 = _mm256_set1_epi8(static_cast<char>(palette[0]));
+		const __m256i shade1 = _mm256_set1_epi8(static_cast<char>(palette[1]));
+		const __m256i shade2 = _mm256_set1_epi8(static_cast<char>(palette[2]));
+		const __m256i shade3 = _mm256_set1_epi8(static_cast<char>(palette[3]));
+
+		for (; i + 32 <= count; i += 32) {
+			__m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+
+			__m256i pixels = _mm256_or_si256(
+				_mm256_or_si256(
+					_mm256_and_si256(_mm256_cmpeq_epi8(index, _mm256_set1_epi8(0)), shade0),
+					_mm256_and_si256(_mm256_cmpeq_epi8(index, _mm256_set1_epi8(1)), shade1)),
+				_mm256_or_si256(
+					_mm256_and_si256(_mm256_cmpeq_epi8(index, _mm256_set1_epi8(2)), shade2),
+					_mm256_and_si256(_mm256_cmpeq_epi8(index, _mm256_set1_epi8(3)), shade3)));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), pixels);
+		}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+		// also the tail of the AVX2 loop, 160 is not a multiple of 32
+		const __m128i shade0_128 = _mm_set1_epi8(static_cast<char>(palette[0]));
+		const __m128i shade1_128 = _mm_set1_epi8(static_cast<char>(palette[1]));
+		const __m128i shade2_128 = _mm_set1_epi8(static_cast<char>(palette[2]));
+		const __m128i shade3_128 = _mm_set1_epi8(static_cast<char>(palette[3]));
+
+		for (; i + 16 <= count; i += 16) {
+			__m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i));
+
+			__m128i pixels = _mm_or_si128(
+				_mm_or_si128(
+					_mm_and_si128(_mm_cmpeq_epi8(index, _mm_set1_epi8(0)), shade0_128),
+					_mm_and_si128(_mm_cmpeq_epi8(index, _mm_set1_epi8(1)), shade1_128)),
+				_mm_or_si128(
+					_mm_and_si128(_mm_cmpeq_epi8(index, _mm_set1_epi8(2)), shade2_128),
+					_mm_and_si128(_mm_cmpeq_epi8(index, _mm_set1_epi8(3)), shade3_128)));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pixels);
+		}
+#endif
+
+		for (; i < count; i++) {
+			out[i] = palette[indices[i] & 0b11];
+		}
+	}
+}
+
+#endif
\ No newline at end of file
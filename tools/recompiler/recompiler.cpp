@@ -0,0 +1,531 @@
+#include "cpu/block_cache.hpp"
+#include "cpu/aot.hpp"
+#include "cartridge/mbc/base.hpp"
+
+#include <stdint.h>
+#include <print>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <tuple>
+#include <string>
+#include <format>
+
+// traces the code reachable from the entry points of a ROM and writes it out as C++ blocks
+// that are compiled into dmg with PEDALS_AOT, see PEDALS_AOT_ROM in CMakeLists.txt
+// usage: dmg_recompiler <rom> <output.cpp>
+
+using pedals::cpu::BlockCache;
+using pedals::cpu::DecodedOp;
+
+// the switchable bank is not known, code in 0x4000-0x7fff can not be followed
+static constexpr int unknown_bank = -1;
+
+// the values the tracer knows registers to have at the current instruction, -1 is unknown
+struct KnownRegisters {
+	int a = -1;
+	int bc = -1;
+	int de = -1;
+	int hl = -1;
+};
+
+enum RegisterMask : uint8_t {
+	MaskA	= 0b0001,
+	MaskBC	= 0b0010,
+	MaskDE	= 0b0100,
+	MaskHL	= 0b1000,
+};
+
+// which of A, BC, DE and HL an instruction overwrites (SP and F are not tracked)
+static uint8_t written_registers(const DecodedOp& op) {
+	static constexpr uint8_t reg8_masks[8] = { MaskBC, MaskBC, MaskDE, MaskDE, MaskHL, MaskHL, 0, MaskA };
+	static constexpr uint8_t reg16_masks[4] = { MaskBC, MaskDE, MaskHL, 0 };
+
+	uint8_t x = op.opcode >> 6;
+	uint8_t y = (op.opcode >> 3) & 7;
+	uint8_t z = op.opcode & 7;
+	uint8_t p = y >> 1;
+
+	switch (x) {
+		case 0: {
+			switch (z) {
+				case 1: return (y & 1) ? static_cast<uint8_t>(MaskHL) : reg16_masks[p];
+				case 2: return ((y & 1) ? MaskA : 0) | ((p >= 2) ? MaskHL : 0);
+				case 3: return reg16_masks[p];
+				case 4: case 5: case 6: return reg8_masks[y];
+				case 7: return (y <= 5) ? MaskA : 0;
+				default: return 0;
+			}
+		}
+
+		case 1: return (op.opcode == 0x76) ? 0 : reg8_masks[y];
+		case 2: return (y == 7) ? 0 : MaskA;
+
+		default: {
+			// BIT leaves its register alone
+			if (op.opcode == 0xcb) return (op.operands[0] >= 0x40 && op.operands[0] < 0x80) ? 0 : reg8_masks[op.operands[0] & 7];
+			if (z == 1 && (y & 1) == 0) return (p == 3) ? static_cast<uint8_t>(MaskA) : reg16_masks[p];
+			if (z == 6) return (y == 7) ? 0 : MaskA;
+			if (op.opcode == 0xf0 || op.opcode == 0xf2 || op.opcode == 0xfa) return MaskA;
+			if (op.opcode == 0xf8) return MaskHL;
+			return 0;
+		}
+	}
+}
+
+// the value of B, C, D, E, H, L or A by its index in the opcode, if known
+static int known_reg8(const KnownRegisters& known, uint8_t index) {
+	int pair = (index < 2) ? known.bc : (index < 4) ? known.de : known.hl;
+
+	if (index == 7) return known.a;
+	if (index == 6 || pair < 0) return -1;
+	return (index & 1) ? (pair & 0xff) : (pair >> 8);
+}
+
+struct TracedBlock {
+	uint32_t bank;
+	uint16_t pc;
+	std::vector<DecodedOp> ops;
+};
+
+class Tracer {
+public:
+	Tracer(const std::vector<uint8_t>& rom) : m_ROM(rom) {
+		m_Features = pedals::mbc::get_mbc_features(rom.size() > 0x147 ? rom[0x147] : 0);
+	}
+
+	void Trace() {
+		// reset, rst and interrupt vectors
+		for (uint16_t vector = 0x00; vector <= 0x38; vector += 8) Enqueue(vector, 1);
+		for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) Enqueue(vector, 1);
+		Enqueue(0x100, 1);
+
+		while (!m_Queue.empty()) {
+			auto [pc, bank] = m_Queue.front();
+			m_Queue.pop_front();
+			TraceBlock(pc, bank);
+		}
+	}
+
+	const std::map<std::pair<uint32_t, uint16_t>, TracedBlock>& GetBlocks() const {
+		return m_Blocks;
+	}
+
+private:
+	// the bank number the MBC ends up with after a write to 0x2000-0x3fff
+	int SelectBank(uint8_t value) const {
+		switch (m_Features.mbc) {
+			case pedals::mbc::MBCType::MBC1: value &= 0b00011111; break;
+			case pedals::mbc::MBCType::MBC3: value &= 0b01111111; break;
+			default: return unknown_bank;
+		}
+
+		return (value == 0) ? 1 : value;
+	}
+
+	// a store that may hit the bank register leaves the bank the MBC ends up with, addresses and values
+	// of -1 are not known. the upper bits MBC1 takes from 0x4000-0x5fff are not followed
+	void Store(int address, int value, int& switchable_bank) const {
+		// plain ROM carts have nothing to switch
+		if (m_Features.mbc == pedals::mbc::MBCType::ROM) return;
+		if (address >= 0 && (address < 0x2000 || address >= 0x4000)) return;
+
+		switchable_bank = (address >= 0 && value >= 0) ? SelectBank(static_cast<uint8_t>(value)) : unknown_bank;
+	}
+
+	bool IsMapped(uint32_t bank, uint16_t address) const {
+		return static_cast<size_t>(bank) * 0x4000 + (address & 0x3fff) < m_ROM.size();
+	}
+
+	uint8_t Read(uint32_t bank, uint16_t address) const {
+		return m_ROM[static_cast<size_t>(bank) * 0x4000 + (address & 0x3fff)];
+	}
+
+	void Enqueue(uint16_t pc, int switchable_bank) {
+		// only cartridge ROM is recompiled
+		if (pc >= 0x8000) return;
+		if (pc >= 0x4000 && switchable_bank == unknown_bank) return;
+
+		if (m_Visited.insert({ pc, switchable_bank }).second) {
+			m_Queue.push_back({ pc, switchable_bank });
+		}
+	}
+
+	void TraceBlock(uint16_t pc, int switchable_bank) {
+		uint32_t bank = (pc < 0x4000) ? 0 : static_cast<uint32_t>(switchable_bank);
+		uint32_t limit = (pc < 0x4000) ? 0x4000 : 0x8000;
+
+		if (!IsMapped(bank, pc)) return;
+
+		// enough to follow 'ld a, n / ld (nn), a' style bank switches
+		KnownRegisters known;
+
+		TracedBlock block { bank, pc, {} };
+		uint32_t address = pc;
+
+		// blocks end at the same lines as the block cache's, so code that comes back in the middle of
+		// a block (from an interrupt) finds a precompiled one where the interpreter's block ends
+		uint32_t line_end = (pc & ~(BlockCache::BlockLine - 1)) + BlockCache::BlockLine;
+
+		while (true) {
+			uint8_t opcode = Read(bank, address);
+			uint8_t length = BlockCache::GetInstructionLength(opcode);
+
+			// the instruction runs into the next bank, the interpreter runs it and comes back after it
+			if (address + length > limit) {
+				if (!BlockCache::EndsBlock(opcode)) Enqueue(static_cast<uint16_t>(address + length), switchable_bank);
+				break;
+			}
+
+			DecodedOp op {};
+			op.address = static_cast<uint16_t>(address);
+			op.opcode = opcode;
+			op.length = length;
+
+			for (uint8_t i = 1; i < length; i++) {
+				op.operands[i - 1] = Read(bank, static_cast<uint16_t>(address + i));
+			}
+
+			op.cycles = BlockCache::GetInstructionCycles(opcode, op.operands[0]);
+			block.ops.push_back(op);
+
+			uint16_t next = static_cast<uint16_t>(address + length);
+			uint16_t imm16 = (op.operands[1] << 8) | op.operands[0];
+			uint16_t relative = static_cast<uint16_t>(next + static_cast<int8_t>(op.operands[0]));
+
+			// stores that can hit the MBC, with the registers from before the instruction
+			switch (opcode) {
+				case 0xea: Store(imm16, known.a, switchable_bank); break;
+				case 0x02: Store(known.bc, known.a, switchable_bank); break;
+				case 0x12: Store(known.de, known.a, switchable_bank); break;
+				case 0x22: case 0x32: Store(known.hl, known.a, switchable_bank); break;
+				case 0x36: Store(known.hl, op.operands[0], switchable_bank); break;
+
+				// ld (hl), r
+				case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77: {
+					Store(known.hl, known_reg8(known, opcode & 7), switchable_bank);
+					break;
+				}
+
+				default: break;
+			}
+
+			uint8_t written = written_registers(op);
+			if (written & MaskA) known.a = -1;
+			if (written & MaskBC) known.bc = -1;
+			if (written & MaskDE) known.de = -1;
+			if (written & MaskHL) known.hl = -1;
+
+			switch (opcode) {
+				case 0x3e: known.a = op.operands[0]; break;
+				case 0xaf: known.a = 0; break;
+				case 0x01: known.bc = imm16; break;
+				case 0x11: known.de = imm16; break;
+				case 0x21: known.hl = imm16; break;
+
+				case 0x18: Enqueue(relative, switchable_bank); break;
+				case 0x20: case 0x28: case 0x30: case 0x38: Enqueue(relative, switchable_bank); Enqueue(next, switchable_bank); break;
+
+				case 0xc3: Enqueue(imm16, switchable_bank); break;
+				case 0xc2: case 0xca: case 0xd2: case 0xda: Enqueue(imm16, switchable_bank); Enqueue(next, switchable_bank); break;
+
+				// calls are assumed to return with the same bank mapped
+				case 0xcd: case 0xc4: case 0xcc: case 0xd4: case 0xdc: Enqueue(imm16, switchable_bank); Enqueue(next, switchable_bank); break;
+				case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff: Enqueue(opcode & 0x38, switchable_bank); Enqueue(next, switchable_bank); break;
+
+				// conditional returns fall through
+				case 0xc0: case 0xc8: case 0xd0: case 0xd8: Enqueue(next, switchable_bank); break;
+
+				default: break;
+			}
+
+			address = next;
+
+			if (BlockCache::EndsBlock(opcode)) break;
+
+			if (address >= line_end) {
+				Enqueue(static_cast<uint16_t>(address), switchable_bank);
+				break;
+			}
+
+			// blocks stop where another traced block starts so every entry point is a block of its own
+			if (m_Visited.contains({ static_cast<uint16_t>(address), switchable_bank })) {
+				break;
+			}
+		}
+
+		if (block.ops.empty()) return;
+
+		// the same code can be reached with different banks in 0x4000-0x7fff, it only has to be emitted once
+		m_Blocks.try_emplace({ bank, pc }, std::move(block));
+	}
+
+private:
+	const std::vector<uint8_t>& m_ROM;
+	pedals::mbc::MBCFeatures m_Features;
+
+	std::deque<std::pair<uint16_t, int>> m_Queue;
+	std::set<std::pair<uint16_t, int>> m_Visited;
+	std::map<std::pair<uint32_t, uint16_t>, TracedBlock> m_Blocks;
+};
+
+static constexpr const char* reg8_names[8] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+static constexpr const char* reg16_names[4] = { "bc", "de", "hl", "sp" };
+
+static std::string alu_source(uint8_t operation, const std::string& value) {
+	switch (operation) {
+		case 0: return std::format("r.a = aot::Add(r, {}, 0);", value);
+		case 1: return std::format("r.a = aot::Add(r, {}, (r.f >> 4) & 1);", value);
+		case 2: return std::format("r.a = aot::Sub(r, {}, 0);", value);
+		case 3: return std::format("r.a = aot::Sub(r, {}, (r.f >> 4) & 1);", value);
+		case 4: return std::format("aot::And(r, {});", value);
+		case 5: return std::format("aot::Xor(r, {});", value);
+		case 6: return std::format("aot::Or(r, {});", value);
+		default: return std::format("aot::Sub(r, {}, 0);", value);
+	}
+}
+
+// C++ for an instruction BlockCache::IsNative() accepts, the jumps are written by write_branch()
+static std::string native_source(const DecodedOp& op) {
+	uint8_t x = op.opcode >> 6;
+	uint8_t y = (op.opcode >> 3) & 7;
+	uint8_t z = op.opcode & 7;
+	uint8_t p = y >> 1;
+	uint16_t imm16 = (op.operands[1] << 8) | op.operands[0];
+
+	if (x == 0) {
+		switch (z) {
+			case 1: {
+				if (y & 1) return std::format("aot::AddHL(r, r.{});", reg16_names[p]);
+				return std::format("r.{} = 0x{:04x};", reg16_names[p], imm16);
+			}
+
+			case 3: return std::format("r.{}{};", reg16_names[p], (y & 1) ? "--" : "++");
+			case 4: return std::format("aot::Inc(r, r.{});", reg8_names[y]);
+			case 5: return std::format("aot::Dec(r, r.{});", reg8_names[y]);
+			case 6: return std::format("r.{} = 0x{:02x};", reg8_names[y], op.operands[0]);
+
+			case 7: {
+				// RLCA, RRCA, RLA and RRA are the CB rotates of A with Z cleared
+				if (y < 4) return std::format("r.a = aot::Shift(r, {}, r.a); r.f &= ~Flags::Zero;", y);
+				if (y == 5) return "r.a = ~r.a; r.f |= Flags::Subtraction | Flags::HalfCarry;";
+				if (y == 6) return "r.f = (r.f & ~(Flags::Subtraction | Flags::HalfCarry)) | Flags::Carry;";
+				return "r.f = (r.f & ~(Flags::Subtraction | Flags::HalfCarry)) ^ Flags::Carry;";
+			}
+
+			// NOP
+			default: return "";
+		}
+	}
+
+	if (x == 1) return std::format("r.{} = r.{};", reg8_names[y], reg8_names[z]);
+	if (x == 2) return alu_source(y, std::format("r.{}", reg8_names[z]));
+	if (z == 6) return alu_source(y, std::format("0x{:02x}", op.operands[0]));
+
+	if (op.opcode == 0xcb) {
+		uint8_t cb = op.operands[0];
+		const char* reg = reg8_names[cb & 7];
+		uint8_t bit = (cb >> 3) & 7;
+
+		switch (cb >> 6) {
+			case 0: return std::format("r.{} = aot::Shift(r, {}, r.{});", reg, bit, reg);
+			case 1: return std::format("aot::Bit(r, {}, r.{});", bit, reg);
+			case 2: return std::format("r.{} &= 0x{:02x};", reg, static_cast<uint8_t>(~(1 << bit)));
+			default: return std::format("r.{} |= 0x{:02x};", reg, static_cast<uint8_t>(1 << bit));
+		}
+	}
+
+	// LD SP, HL
+	return "r.sp = r.hl;";
+}
+
+// a jump at the end of a run of C++ instructions, taken conditional jumps cost 4 more T-cycles
+static void write_branch(std::ofstream& out, const DecodedOp& op) {
+	uint16_t next = static_cast<uint16_t>(op.address + op.length);
+	uint16_t imm16 = (op.operands[1] << 8) | op.operands[0];
+
+	if (op.opcode == 0xe9) {
+		std::println(out, "\t\tr.pc = r.hl;");
+		return;
+	}
+
+	bool relative = (op.opcode & 0xc0) == 0;
+	uint16_t target = relative ? static_cast<uint16_t>(next + static_cast<int8_t>(op.operands[0])) : imm16;
+
+	if (!BlockCache::IsConditionalBranch(op.opcode)) {
+		std::println(out, "\t\tr.pc = 0x{:04x};", target);
+		return;
+	}
+
+	uint8_t y = (op.opcode >> 3) & 7;
+	const char* flag = (y & 0b10) ? "Flags::Carry" : "Flags::Zero";
+
+	std::println(out, "\t\tr.pc = 0x{:04x};", next);
+	std::println(out, "\t\tif ((r.f & {}) {} 0) {{", flag, (y & 1) ? "!=" : "==");
+	std::println(out, "\t\t\tr.pc = 0x{:04x};", target);
+	std::println(out, "\t\t\tcontext->elapsed += 4;");
+	std::println(out, "\t\t\tcontext->pending += 4;");
+	std::println(out, "\t\t}}");
+}
+
+// runs of register only instructions are plain C++ guarded by the same budget check as the JIT's
+// native code, with the handlers as the fallback. everything else calls its handler
+static void write_block(std::ofstream& out, const TracedBlock& block) {
+	std::string name = std::format("{:04x}_{:04x}", block.bank, block.pc);
+
+	std::println(out, "static const DecodedOp ops_{}[] = {{", name);
+	for (const DecodedOp& op : block.ops) {
+		std::println(out, "\t{{ 0x{:04x}, 0x{:02x}, {}, {}, {{ 0x{:02x}, 0x{:02x} }} }},", op.address, op.opcode, op.length, op.cycles, op.operands[0], op.operands[1]);
+	}
+	std::println(out, "}};");
+	std::println(out, "");
+
+	std::println(out, "static void block_{}(SM83* cpu, JitContext* context) {{", name);
+	std::println(out, "\tconst auto& handlers = SM83::GetCompiledHandlers();");
+	std::println(out, "\tconst DecodedOp* ops = ops_{};", name);
+
+	// the last instruction always leaves the block so it needs no check
+	auto write_handler = [&](size_t index, const char* indent) {
+		if (index + 1 < block.ops.size()) {
+			std::println(out, "{}if (handlers[0x{:02x}](cpu, context, &ops[{}])) return;", indent, block.ops[index].opcode, index);
+		} else {
+			std::println(out, "{}handlers[0x{:02x}](cpu, context, &ops[{}]);", indent, block.ops[index].opcode, index);
+		}
+	};
+
+	// the C++ instructions leave pc behind, it is only stored when a handler needs it
+	bool pc_current = true;
+
+	size_t i = 0;
+	while (i < block.ops.size()) {
+		const DecodedOp& op = block.ops[i];
+
+		if (!BlockCache::IsNative(op)) {
+			if (!pc_current) {
+				std::println(out, "\tcpu->GetRegistersRef().pc = 0x{:04x};", op.address);
+				pc_current = true;
+			}
+
+			write_handler(i, "\t");
+			i++;
+			continue;
+		}
+
+		size_t end = i;
+		uint32_t cycles = 0;
+		uint32_t max_cycles = 0;
+
+		while (end < block.ops.size() && BlockCache::IsNative(block.ops[end])) {
+			cycles += block.ops[end].cycles;
+			max_cycles += block.ops[end].cycles + (BlockCache::IsConditionalBranch(block.ops[end].opcode) ? 4 : 0);
+			end++;
+		}
+
+		const DecodedOp& last = block.ops[end - 1];
+
+		std::vector<std::string> sources;
+		for (size_t k = i; k < end; k++) {
+			if (BlockCache::IsBranch(block.ops[k].opcode)) continue;
+
+			std::string source = native_source(block.ops[k]);
+			if (!source.empty()) sources.push_back(std::move(source));
+		}
+
+		std::println(out, "");
+		std::println(out, "\tif (context->budget >= {}) {{", max_cycles);
+
+		// a run of NOPs does not need the registers
+		if (!sources.empty() || BlockCache::IsBranch(last.opcode) || end == block.ops.size()) {
+			std::println(out, "\t\tRegisters& r = cpu->GetRegistersRef();");
+		}
+
+		for (const std::string& source : sources) {
+			std::println(out, "\t\t{}", source);
+		}
+
+		std::println(out, "\t\tcontext->elapsed += {};", cycles);
+		std::println(out, "\t\tcontext->pending += {};", cycles);
+
+		// the handlers of a run that ends the block keep pc current themselves, storing it after the
+		// if would undo an interrupt the last one took
+		if (BlockCache::IsBranch(last.opcode)) {
+			write_branch(out, last);
+		} else if (end == block.ops.size()) {
+			std::println(out, "\t\tr.pc = 0x{:04x};", static_cast<uint16_t>(last.address + last.length));
+		}
+
+		std::println(out, "\t}} else {{");
+		for (size_t k = i; k < end; k++) {
+			write_handler(k, "\t\t");
+		}
+		std::println(out, "\t}}");
+		if (end < block.ops.size()) std::println(out, "");
+
+		pc_current = BlockCache::IsBranch(last.opcode) || end == block.ops.size();
+		i = end;
+	}
+
+	std::println(out, "}}");
+	std::println(out, "");
+}
+
+static void write_source(std::ofstream& out, const std::vector<uint8_t>& rom, std::string_view rom_name, const std::map<std::pair<uint32_t, uint16_t>, TracedBlock>& blocks) {
+	std::println(out, "// generated by dmg_recompiler from {}, do not edit", rom_name);
+	std::println(out, "#include \"cpu/aot_ops.hpp\"");
+	std::println(out, "");
+	std::println(out, "using namespace pedals::cpu;");
+	std::println(out, "");
+
+	for (const auto& [key, block] : blocks) {
+		write_block(out, block);
+	}
+
+	std::println(out, "const PrecompiledBlock pedals::cpu::aot::blocks[] = {{");
+	for (const auto& [key, block] : blocks) {
+		std::println(out, "\t{{ 0x{:04x}, 0x{:04x}, block_{:04x}_{:04x} }},", block.bank, block.pc, block.bank, block.pc);
+	}
+	std::println(out, "}};");
+	std::println(out, "");
+	std::println(out, "const size_t pedals::cpu::aot::block_count = {};", blocks.size());
+	std::println(out, "const uint32_t pedals::cpu::aot::rom_hash = 0x{:08x};", pedals::cpu::aot::HashROM(rom));
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::println(stderr, "usage: {} <rom> <output.cpp>", argv[0]);
+		return 1;
+	}
+
+	std::ifstream file(argv[1], std::ios::binary | std::ios::ate);
+	if (!file) {
+		std::println(stderr, "recompiler: failed to open rom file '{}'", argv[1]);
+		return 1;
+	}
+
+	std::streamsize size = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	std::vector<uint8_t> rom(size);
+	file.read(reinterpret_cast<char*>(rom.data()), size);
+
+	if (rom.size() < 0x150) {
+		std::println(stderr, "recompiler: '{}' is too small to be a rom", argv[1]);
+		return 1;
+	}
+
+	Tracer tracer(rom);
+	tracer.Trace();
+
+	std::ofstream out(argv[2]);
+	if (!out) {
+		std::println(stderr, "recompiler: failed to open output file '{}'", argv[2]);
+		return 1;
+	}
+
+	write_source(out, rom, argv[1], tracer.GetBlocks());
+	std::println("recompiler: wrote {} blocks to '{}'", tracer.GetBlocks().size(), argv[2]);
+
+	return 0;
+}
\ No newline at end of file